@@ -33,14 +33,54 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <vector>
+#include <string>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <iterator>
+#include <algorithm>
 
 #if defined(WIN32) || defined(_WIN32)
 	#define USE_WINDOWS_TIMERS
 	#include <windows.h>
 	#include <time.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
 #else
 	#include <sys/time.h>
+	#include <sys/resource.h>
+	#include <time.h>
+	#ifdef __linux__
+		#include <sched.h>
+	#endif
+#endif
+
+// Output file compression is done on a background thread when the 
+// standard thread library is available.  Otherwise it is done inline.  
+// The instrumented mutex wrappers also require it.
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1700)
+	#define USE_STD_THREADS
+	#include <thread>
+	#include <mutex>
+	#include <condition_variable>
+	#include <atomic>
+	#include <chrono>
+#endif
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+	#define USE_STD_SHARED_MUTEX
+	#include <shared_mutex>
+#endif
+
+// Define QUICKPROF_USE_ZLIB and/or QUICKPROF_USE_ZSTD (and link against 
+// the matching library) to enable those output file compression formats.
+#ifdef QUICKPROF_USE_ZLIB
+	#include <zlib.h>
+#endif
+#ifdef QUICKPROF_USE_ZSTD
+	#include <zstd.h>
 #endif
 
 /// Use this macro to access the profiler singleton.  For example: 
@@ -55,19 +95,157 @@
 namespace quickprof
 {
 
+/// A string registered with Profiler::internString, so that it can be 
+/// attached to blocks without copying it.
+struct InternedString
+{
+	explicit InternedString(unsigned int stringId=0) : id(stringId)
+	{
+		// do nothing
+	}
+
+	/// The index of the string in the Profiler's string table.
+	unsigned int id;
+};
+
+/// A typed argument attached to a block update, e.g. a table name or an 
+/// asset id (see Profiler::beginBlock).  Arguments are stored as plain 
+/// values and only formatted when exported.
+struct BlockArg
+{
+	/// The type of value stored.
+	enum Type
+	{
+		NONE,
+		INTEGER,
+		STRING
+	};
+
+	BlockArg() : type(NONE), value(0)
+	{
+		// do nothing
+	}
+
+	BlockArg(long long int integer) : type(INTEGER), value(integer)
+	{
+		// do nothing
+	}
+
+	BlockArg(InternedString string) : type(STRING), value(string.id)
+	{
+		// do nothing
+	}
+
+	bool operator==(const BlockArg& other) const
+	{
+		return type == other.type && value == other.value;
+	}
+
+	/// The type of value stored.
+	Type type;
+
+	/// The integer value, or the id of the interned string.
+	long long int value;
+};
+
+/// The aggregated time of one argument value of a block (see 
+/// Profiler::setArgAggregation).
+struct BlockVariant
+{
+	BlockVariant() :
+		key(),
+		totalMicroseconds(0),
+		numCalls(0)
+	{
+		// do nothing
+	}
+
+	/// The argument value.  A key of type NONE marks an unused slot.
+	BlockArg key;
+
+	/// The total accumulated time (in us) spent in the block with this 
+	/// argument value.
+	unsigned long long int totalMicroseconds;
+
+	/// The number of block updates with this argument value.
+	unsigned long long int numCalls;
+};
+
 /// A simple data structure representing a single timed block 
 /// of code.
 struct ProfileBlock
 {
 	ProfileBlock() :
+		name(NULL),
+		enabled(true),
+		retired(false),
 		currentBlockStartMicroseconds(0),
 		currentCycleTotalMicroseconds(0),
 		avgCycleTotalMicroseconds(0),
-		totalMicroseconds(0)
+		totalMicroseconds(0),
+		numCalls(0),
+		currentBlockStartCpuMicroseconds(0),
+		currentBlockStartVoluntarySwitches(0),
+		currentBlockStartInvoluntarySwitches(0),
+		totalCpuMicroseconds(0),
+		totalVoluntarySwitches(0),
+		totalInvoluntarySwitches(0),
+		numCpuSamples(0),
+		currentBlockStartCpu(-1),
+		numPlacementSamples(0),
+		numCpuMigrations(0),
+		numNodeMigrations(0),
+		numSkewedSamples(0),
+		cpuMicroseconds(),
+		nodeMicroseconds(),
+		currentNumArgs(0),
+		variantArgIndex(0),
+		variants()
 	{
 		// do nothing
 	}
 
+	/// Clears all statistics.  The name and aggregation settings are 
+	/// kept.
+	void reset()
+	{
+		currentBlockStartMicroseconds = 0;
+		currentCycleTotalMicroseconds = 0;
+		avgCycleTotalMicroseconds = 0;
+		totalMicroseconds = 0;
+		numCalls = 0;
+		currentBlockStartCpuMicroseconds = 0;
+		currentBlockStartVoluntarySwitches = 0;
+		currentBlockStartInvoluntarySwitches = 0;
+		totalCpuMicroseconds = 0;
+		totalVoluntarySwitches = 0;
+		totalInvoluntarySwitches = 0;
+		numCpuSamples = 0;
+		currentBlockStartCpu = -1;
+		numPlacementSamples = 0;
+		numCpuMigrations = 0;
+		numNodeMigrations = 0;
+		numSkewedSamples = 0;
+		cpuMicroseconds.clear();
+		nodeMicroseconds.clear();
+		currentNumArgs = 0;
+		variants.assign(variants.size(), BlockVariant());
+	}
+
+	/// The maximum number of arguments attached to a block update.
+	static const size_t MAX_ARGS = 2;
+
+	/// The block name (owned by the Profiler).
+	const std::string* name;
+
+	/// Determines whether this block is timed.  Blocks are disabled while 
+	/// the Profiler is not initialized (see also Profiler::enableBlocks).
+	bool enabled;
+
+	/// Whether the block was erased from the Profiler's reports when it 
+	/// was re-initialized.  It is restored when it is used again.
+	bool retired;
+
 	/// The starting time (in us) of the current block update.
 	unsigned long long int currentBlockStartMicroseconds;
 
@@ -81,6 +259,119 @@ struct ProfileBlock
 
 	/// The total accumulated time (in us) spent in this block.
 	unsigned long long int totalMicroseconds;
+
+	/// The number of completed block updates.  For lock blocks this is 
+	/// the number of acquisitions (".wait") or exclusive acquisitions 
+	/// (".hold"), and for parallel region idle blocks the number of region 
+	/// instances.
+	unsigned long long int numCalls;
+
+	/// The thread CPU time and context switch counts at the start of the 
+	/// current block update (only used if CPU timing is enabled).
+	unsigned long long int currentBlockStartCpuMicroseconds;
+	unsigned long long int currentBlockStartVoluntarySwitches;
+	unsigned long long int currentBlockStartInvoluntarySwitches;
+
+	/// The total accumulated CPU time (in us) used by the thread in this 
+	/// block.  The rest of the block's time was spent off-CPU (blocked on 
+	/// I/O, locks, page faults, or waiting to be scheduled).
+	unsigned long long int totalCpuMicroseconds;
+
+	/// The total number of voluntary (e.g. blocking) and involuntary 
+	/// (preempted) context switches in this block.
+	unsigned long long int totalVoluntarySwitches;
+	unsigned long long int totalInvoluntarySwitches;
+
+	/// The number of block updates with CPU time measurements.  Times 
+	/// added without them (e.g. lock wait and idle times) have no on/off-CPU 
+	/// split.
+	unsigned long long int numCpuSamples;
+
+	/// The CPU at the start of the current block update, or -1 if 
+	/// unknown (only used if placement tracking is enabled).
+	int currentBlockStartCpu;
+
+	/// The number of block updates with known CPU placement, and how many 
+	/// of them ended on a different CPU or NUMA node than they started.
+	unsigned long long int numPlacementSamples;
+	unsigned long long int numCpuMigrations;
+	unsigned long long int numNodeMigrations;
+
+	/// The number of block updates that ended before they started 
+	/// according to the clock, e.g. due to unsynchronized CPU clocks.  
+	/// These updates are counted with a zero duration.
+	unsigned long long int numSkewedSamples;
+
+	/// The total time (in us) spent in this block by the CPU and NUMA 
+	/// node each block update started on.  These are empty unless 
+	/// placement tracking is enabled.
+	std::vector<unsigned long long int> cpuMicroseconds;
+	std::vector<unsigned long long int> nodeMicroseconds;
+
+	/// The arguments of the current block update.
+	BlockArg currentArgs[MAX_ARGS];
+	size_t currentNumArgs;
+
+	/// The argument used as an aggregation key (see 
+	/// Profiler::setArgAggregation).
+	size_t variantArgIndex;
+
+	/// The aggregated time per argument value.  This is empty unless 
+	/// aggregation is enabled; otherwise it has a fixed number of slots, 
+	/// the last of which collects all values that don't fit.
+	std::vector<BlockVariant> variants;
+};
+
+/// A node in the call tree built from nested timing blocks.  There is 
+/// one node per distinct path of nested blocks (e.g. "a;b;c"), so nodes 
+/// are only allocated the first time a path is seen.
+struct CallTreeNode
+{
+	CallTreeNode(const std::string* blockName, ProfileBlock* profileBlock, 
+		CallTreeNode* parentNode) :
+		name(blockName),
+		block(profileBlock),
+		parent(parentNode),
+		children(),
+		startMicroseconds(0),
+		totalMicroseconds(0),
+		childMicroseconds(0),
+		numCalls(0)
+	{
+		// do nothing
+	}
+
+	~CallTreeNode()
+	{
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			delete children[i];
+		}
+	}
+
+	/// The block name (owned by the Profiler), or NULL for the root.
+	const std::string* name;
+
+	/// The block timed by this node, or NULL for the root.
+	ProfileBlock* block;
+
+	/// The enclosing node, or NULL for the root.
+	CallTreeNode* parent;
+
+	/// The nodes for blocks nested directly inside this one.
+	std::vector<CallTreeNode*> children;
+
+	/// The starting time (in us) of the current block update.
+	unsigned long long int startMicroseconds;
+
+	/// The total time (in us) spent in this node, including children.
+	unsigned long long int totalMicroseconds;
+
+	/// The total time (in us) spent in child nodes.
+	unsigned long long int childMicroseconds;
+
+	/// The number of completed block updates.
+	unsigned long long int numCalls;
 };
 
 /// A cross-platform clock class inspired by the Timer classes in 
@@ -197,594 +488,4762 @@ private:
 #endif
 };
 
-/// A set of ways to represent timing results.
-enum TimeFormat
+/// A snapshot of the calling thread's CPU usage.
+struct CpuUsage
 {
-	SECONDS,
-	MILLISECONDS,
-	MICROSECONDS,
-	PERCENT
+	CpuUsage() :
+		cpuMicroseconds(0),
+		voluntarySwitches(0),
+		involuntarySwitches(0)
+	{
+		// do nothing
+	}
+
+	/// The CPU time (in us) used by the thread, in user and kernel mode.
+	unsigned long long int cpuMicroseconds;
+
+	/// The number of voluntary and involuntary context switches.  These 
+	/// are only available on Linux; elsewhere they are zero.
+	unsigned long long int voluntarySwitches;
+	unsigned long long int involuntarySwitches;
 };
 
-/// A singleton class that manages timing for a set of profiling blocks.
-class Profiler
+/// Measures the CPU time used by the calling thread.
+class CpuClock
 {
 public:
 	/**
-	Useful for creating multiple Profiler instances.
-
-	Normally the Profiler class should be accessed only through the 
-	singleton instance method, which provides global access to a single 
-	static Profiler instance.  However, it is also possible to create 
-	several local Profiler instances, if necessary.
+	Returns true if thread CPU time can be measured on this platform.
 	*/
-	inline Profiler();
-
-	inline ~Profiler();
+	static bool isSupported()
+	{
+#if defined(USE_WINDOWS_TIMERS) || defined(RUSAGE_THREAD) || defined(CLOCK_THREAD_CPUTIME_ID)
+		return true;
+#else
+		return false;
+#endif
+	}
 
 	/**
-	Accesses the singleton instance.
+	Reads the calling thread's CPU usage.
 
-	@return The Profiler instance.
+	On Linux the CPU time comes from clock_gettime(CLOCK_THREAD_CPUTIME_ID), 
+	and the context switch counts from getrusage(RUSAGE_THREAD).  The 
+	CPU times reported by getrusage are only sampled at scheduler ticks, 
+	so they are too coarse (and can even be attributed to the wrong 
+	block) for short blocks.
+
+	@param usage Receives the current CPU usage.
 	*/
-	inline static Profiler& instance();
+	static void getUsage(CpuUsage& usage)
+	{
+#if defined(USE_WINDOWS_TIMERS)
+		FILETIME creationTime, exitTime, kernelTime, userTime;
+		if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, 
+			&kernelTime, &userTime))
+		{
+			// FILETIMEs are in units of 100 ns.
+			ULARGE_INTEGER kernel, user;
+			kernel.LowPart = kernelTime.dwLowDateTime;
+			kernel.HighPart = kernelTime.dwHighDateTime;
+			user.LowPart = userTime.dwLowDateTime;
+			user.HighPart = userTime.dwHighDateTime;
+			usage.cpuMicroseconds = (kernel.QuadPart + user.QuadPart) / 10;
+		}
+#elif defined(CLOCK_THREAD_CPUTIME_ID) || defined(RUSAGE_THREAD)
+#ifdef CLOCK_THREAD_CPUTIME_ID
+		struct timespec ts;
+		if (0 == clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		{
+			usage.cpuMicroseconds = static_cast<unsigned long long>(ts.tv_sec) * 
+				1000000 + static_cast<unsigned long long>(ts.tv_nsec) / 1000;
+		}
+#endif
+#ifdef RUSAGE_THREAD
+		struct rusage ru;
+		if (0 == getrusage(RUSAGE_THREAD, &ru))
+		{
+#ifndef CLOCK_THREAD_CPUTIME_ID
+			usage.cpuMicroseconds = 
+				static_cast<unsigned long long>(ru.ru_utime.tv_sec + 
+				ru.ru_stime.tv_sec) * 1000000 + 
+				static_cast<unsigned long long>(ru.ru_utime.tv_usec + 
+				ru.ru_stime.tv_usec);
+#endif
+			usage.voluntarySwitches = static_cast<unsigned long long>(ru.ru_nvcsw);
+			usage.involuntarySwitches = static_cast<unsigned long long>(ru.ru_nivcsw);
+		}
+#endif
+#else
+		(void)usage;
+#endif
+	}
+};
 
+#ifdef USE_STD_THREADS
+/// A clock that any thread may read at any time, used to time locks and 
+/// parallel region work.  Only differences between two readings are 
+/// meaningful.
+class SteadyClock
+{
+public:
 	/**
-	Initializes the profiler. 
-
-	This must be called first.  If this is never called, the profiler 
-	is effectively disabled, and all other functions will return 
-	immediately.  This can be called more than once to re-initialize the 
-	profiler, which erases all previous profiling block names and their 
-	timing data.
+	Returns the current time in us.
 
-	@param smoothing      The measured duration for each profile 
-                            block can be averaged across multiple 
-                            cycles, and this parameter defines the 
-                            smoothness of this averaging process.
-                            The higher the value, the smoother the 
-                            resulting average durations will appear.  
-                            Leaving it at zero will essentially 
-                            disable the smoothing effect.  More 
-                            specifically, this parameter is a time 
-                            constant (defined in terms of cycles) that 
-                            defines an exponentially-weighted moving 
-                            average.  For example, a value of 4.0 
-                            means the past four cycles will contribute 
-                            63% of the current weighted average.  This 
-                            value must be >= 0.
-	@param outputFilename If defined, enables timing data to be 
-                            printed to a data file for later analysis.
-	@param printPeriod    Defines how often data is printed to the 
-                            file, in number of profiling cycles.  For 
-                            example, set this to 1 if you want data 
-                            printed after each cycle, or 5 if you want 
-                            it printed every 5 cycles.  It is a good 
-                            idea to increase this if you don't want 
-                            huge data files.  Keep in mind, however, 
-                            that when you increase this, you might 
-                            want to increase the smoothing 
-                            parameter.  (A good heuristic is to set 
-                            the smoothing parameter equal to the 
-                            print period.)  This value must be >= 1.
-	@param printFormat    Defines the format used when printing data 
-                            to a file.
+	@return The current time in microseconds.
 	*/
-	inline void init(double smoothing=0.0, 
-		const std::string& outputFilename="", size_t printPeriod=1,
-		TimeFormat printFormat=MILLISECONDS);
+	static unsigned long long int getTimeMicroseconds()
+	{
+		return static_cast<unsigned long long int>(
+			std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+};
 
-	/**
-	Begins timing the named block of code.
+/// The counters of one group of wrappers of a lock (see LockStats).  
+/// Each group is padded so that its counters don't share a cache line 
+/// with another group's.
+struct LockCounters
+{
+	LockCounters() :
+		numAcquisitions(0),
+		numSharedAcquisitions(0),
+		numContended(0),
+		waitMicroseconds(0),
+		holdMicroseconds(0)
+	{
+		// do nothing
+	}
 
-	@param name The name of the block.
-	*/
-	inline void beginBlock(const std::string& name);
+	/// Clears all counters.
+	void reset()
+	{
+		numAcquisitions = 0;
+		numSharedAcquisitions = 0;
+		numContended = 0;
+		waitMicroseconds = 0;
+		holdMicroseconds = 0;
+	}
 
-	/**
-	Defines the end of the named timing block.
+	/// The number of exclusive and shared acquisitions, and how many of 
+	/// them had to wait for another thread.
+	std::atomic<unsigned long long> numAcquisitions;
+	std::atomic<unsigned long long> numSharedAcquisitions;
+	std::atomic<unsigned long long> numContended;
 
-	@param name The name of the block.
-	*/
-	inline void endBlock(const std::string& name);
+	/// The total time (in us) spent waiting for and holding the lock.
+	std::atomic<unsigned long long> waitMicroseconds;
+	std::atomic<unsigned long long> holdMicroseconds;
 
-	/**
-	Defines the end of a profiling cycle. 
+	/// Keeps the next group's counters at least a cache line away.
+	char padding[128 - 5 * sizeof(std::atomic<unsigned long long>)];
+};
 
-	Use this regularly by calling it at the end of all timing blocks.  
-	This is necessary for smoothing and for file output, but not if 
-	you just want a total summary at the end of execution (i.e. from 
-	getSummary).  This must not be called within a timing block.
-	*/
-	inline void endCycle();
+/// Contention statistics for one named lock (see Mutex).  These are 
+/// updated concurrently by all threads using the lock.  To keep the 
+/// cost of recording low, an uncontended acquisition and a release each 
+/// update a single counter, and the wrappers of a lock (e.g. a set of 
+/// striped locks sharing a name) are spread over several counter groups.
+struct LockStats
+{
+	/// The number of counter groups.
+	static const size_t NUM_COUNTER_GROUPS = 8;
 
-	/**
-	Returns the average time used in the named block per profiling cycle.
-		
-	If smoothing is disabled (see init), this returns the most recent 
-	duration measurement.
+	/// The number of wait time histogram buckets.  Bucket 0 counts waits 
+	/// under 1 us, and bucket i counts waits in [2^(i-1), 2^i) us.  The 
+	/// last bucket also counts all longer waits.
+	static const size_t NUM_HISTOGRAM_BUCKETS = 24;
 
-	@param name   The name of the block.
-	@param format The desired time format to use for the result.
-	@return       The block's average duration per cycle.
-	*/
-	inline double getAvgDuration(const std::string& name, 
-		TimeFormat format) const;
+	LockStats() :
+		enabled(false),
+		nextCounterGroup(0),
+		collectedAcquisitions(0),
+		collectedExclusiveAcquisitions(0),
+		collectedWaitMicroseconds(0),
+		collectedHoldMicroseconds(0)
+	{
+		reset();
+	}
+
+	/// Clears all statistics.
+	void reset()
+	{
+		for (size_t i = 0; i < NUM_COUNTER_GROUPS; ++i)
+		{
+			counters[i].reset();
+		}
+		for (size_t i = 0; i < NUM_HISTOGRAM_BUCKETS; ++i)
+		{
+			contendedWaitHistogram[i] = 0;
+		}
+		collectedAcquisitions = 0;
+		collectedExclusiveAcquisitions = 0;
+		collectedWaitMicroseconds = 0;
+		collectedHoldMicroseconds = 0;
+	}
 
 	/**
-	Returns the total time spent in the named block since the profiler was 
-	initialized.
+	Returns the counter group for a new wrapper of the lock.
 
-	@param name   The name of the block.
-	@param format The desired time format to use for the result.
-	@return       The block total time.
+	@return The counter group.
 	*/
-	inline double getTotalDuration(const std::string& name, 
-		TimeFormat format) const;
+	LockCounters* getCounters()
+	{
+		return &counters[nextCounterGroup.fetch_add(1, std::memory_order_relaxed) % 
+			NUM_COUNTER_GROUPS];
+	}
 
 	/**
-	Computes the elapsed time since the profiler was initialized.
+	Returns the sum of one counter over all counter groups.
 
-	@param format The desired time format to use for the result.
-	@return The elapsed time.
+	@param counter The counter, e.g. &LockCounters::numAcquisitions.
+	@return        The total.
 	*/
-	inline double getTimeSinceInit(TimeFormat format) const;
+	unsigned long long int getTotal(
+		std::atomic<unsigned long long> LockCounters::* counter) const
+	{
+		unsigned long long int total = 0;
+		for (size_t i = 0; i < NUM_COUNTER_GROUPS; ++i)
+		{
+			total += (counters[i].*counter).load(std::memory_order_relaxed);
+		}
+		return total;
+	}
 
 	/**
-	Returns a summary of total times in each block.
+	Records one lock acquisition.
 
-	@param format The desired time format to use for the results.
-	@return       The timing summary as a string.
+	@param group     The wrapper's counter group.
+	@param waitTime  The time (in us) spent waiting for the lock.
+	@param contended Whether the lock was already held by another thread.
+	@param shared    Whether this is a shared acquisition.
 	*/
-	inline std::string getSummary(TimeFormat format=PERCENT) const;
+	void recordAcquisition(LockCounters& group, unsigned long long int waitTime, 
+		bool contended, bool shared=false)
+	{
+		if (shared) group.numSharedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		else group.numAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		if (!contended) return;
 
-	/**
-	Returns the number of blocks currently defined (e.g. for iterating).
+		group.numContended.fetch_add(1, std::memory_order_relaxed);
+		group.waitMicroseconds.fetch_add(waitTime, std::memory_order_relaxed);
 
-	@return The number of blocks.
-	*/
-	inline size_t getNumBlocks() const;
+		size_t bucket = 0;
+		while (waitTime > 0 && bucket < NUM_HISTOGRAM_BUCKETS - 1)
+		{
+			waitTime >>= 1;
+			++bucket;
+		}
+		contendedWaitHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
 
 	/**
-	Returns the name of a block (e.g. for iterating).
+	Records the time a lock was held.
 
-	@param i The block index.
-	@return  The block name as a string, or empty string if index is invalid.
+	@param group    The wrapper's counter group.
+	@param holdTime The time (in us) the lock was held.
 	*/
-	inline const std::string& getBlockName(size_t i) const;
+	void recordHold(LockCounters& group, unsigned long long int holdTime)
+	{
+		group.holdMicroseconds.fetch_add(holdTime, std::memory_order_relaxed);
+	}
+
+	/// The counter groups.  These come first so the frequently read 
+	/// members below don't share a cache line with them.
+	LockCounters counters[NUM_COUNTER_GROUPS];
+
+	/// Determines whether the lock is timed (i.e. the profiler is enabled).
+	std::atomic<bool> enabled;
+
+	/// The counter group of the next wrapper.
+	std::atomic<unsigned int> nextCounterGroup;
+
+	/// The number of contended acquisitions by wait time.  Uncontended 
+	/// acquisitions (which belong in bucket 0) are not included.
+	std::atomic<unsigned long long> contendedWaitHistogram[NUM_HISTOGRAM_BUCKETS];
+
+	/// The totals already added to the lock's profile blocks (see 
+	/// Profiler::endCycle).  These are only accessed by the profiler.
+	unsigned long long int collectedAcquisitions;
+	unsigned long long int collectedExclusiveAcquisitions;
+	unsigned long long int collectedWaitMicroseconds;
+	unsigned long long int collectedHoldMicroseconds;
+};
+
+/// A parallel section of code whose work is split across threads (see 
+/// Profiler::beginParallelRegion).  Tracks how evenly the work is 
+/// balanced.
+struct ParallelRegion
+{
+	/// The busy time of one participating thread in the current region 
+	/// instance.
+	struct ThreadWork
+	{
+		std::thread::id id;
+		unsigned long long int busyMicroseconds;
+		unsigned long long int workStartMicroseconds;
+		bool working;
+	};
+
+	/// The busy time of one worker in the current region instance, for 
+	/// work timed through a region handle (see 
+	/// Profiler::getRegionHandle).  Only the worker's own thread writes 
+	/// to it while the instance runs, and slots are padded so workers 
+	/// don't share cache lines.
+	struct WorkerSlot
+	{
+		WorkerSlot() :
+			busyMicroseconds(0),
+			workStartMicroseconds(0),
+			working(false),
+			participated(false)
+		{
+			// do nothing
+		}
+
+		std::atomic<unsigned long long> busyMicroseconds;
+		std::atomic<unsigned long long> workStartMicroseconds;
+		std::atomic<bool> working;
+		std::atomic<bool> participated;
+
+		/// Keeps the next slot at least a cache line away.
+		char padding[128 - 2 * sizeof(std::atomic<unsigned long long>) - 
+			2 * sizeof(std::atomic<bool>)];
+	};
+
+	ParallelRegion() :
+		active(false),
+		startMicroseconds(0),
+		threads(),
+		workers(NULL),
+		numWorkers(0),
+		currentCycleInstances(0),
+		currentCycleImbalance(0),
+		avgCycleImbalance(0),
+		numInstances(0),
+		totalImbalance(0),
+		maxImbalance(0),
+		totalIdleMicroseconds(0),
+		totalDispatchMicroseconds(0),
+		stragglers(),
+		workerStragglers()
+	{
+		// do nothing
+	}
+
+	~ParallelRegion()
+	{
+		delete [] workers;
+	}
+
+	/// Clears all statistics.  The worker slots are kept.
+	void reset()
+	{
+		active = false;
+		threads.clear();
+		currentCycleInstances = 0;
+		currentCycleImbalance = 0;
+		avgCycleImbalance = 0;
+		numInstances = 0;
+		totalImbalance = 0;
+		maxImbalance = 0;
+		totalIdleMicroseconds = 0;
+		totalDispatchMicroseconds = 0;
+		stragglers.clear();
+		workerStragglers.clear();
+	}
+
+	/// Whether an instance of the region is currently running.  Workers 
+	/// using a region handle read this without locking.
+	std::atomic<bool> active;
+
+	/// The starting time (in us) of the current instance.
+	unsigned long long int startMicroseconds;
+
+	/// The threads that have worked in the current instance through the 
+	/// region name.
+	std::vector<ThreadWork> threads;
+
+	/// The worker slots used through region handles.
+	WorkerSlot* workers;
+	size_t numWorkers;
+
+	/// The number of instances and the summed imbalance of the current 
+	/// profiling cycle.  (The idle time per cycle is in the region's 
+	/// idle block.)
+	unsigned long long int currentCycleInstances;
+	double currentCycleImbalance;
+
+	/// The mean imbalance per instance, averaged across profiling cycles 
+	/// like the block times.
+	double avgCycleImbalance;
+
+	/// Totals since the profiler was initialized.
+	unsigned long long int numInstances;
+	double totalImbalance;
+	double maxImbalance;
+	unsigned long long int totalIdleMicroseconds;
+
+	/// The total time (in us) the region ran beyond the straggler's busy 
+	/// time, e.g. to dispatch the work and join the threads.
+	unsigned long long int totalDispatchMicroseconds;
+
+	/// The number of instances in which each thread (or worker, when 
+	/// using a region handle) was the straggler, i.e. the busiest 
+	/// thread, which set the region's duration.
+	std::map<std::thread::id, unsigned long long int> stragglers;
+	std::map<size_t, unsigned long long int> workerStragglers;
 
 private:
+	ParallelRegion(const ParallelRegion&);
+	ParallelRegion& operator=(const ParallelRegion&);
+};
+#endif
+
+/// Determines which CPU and NUMA node the calling thread runs on.
+class CpuPlacement
+{
+public:
 	/**
-	Returns everything to its initial state.
+	Returns true if the current CPU can be determined on this platform.
+	*/
+	static bool isSupported()
+	{
+#if defined(USE_WINDOWS_TIMERS) || defined(__linux__)
+		return true;
+#else
+		return false;
+#endif
+	}
 
-	Deallocates memory, closes output files, and resets all variables.  
-	This is called when the profiler is re-initialized and when the 
-	process exits.
+	/**
+	Returns the CPU the calling thread is running on.  On Linux this 
+	uses sched_getcpu, which is served by the vDSO (using rdtscp or 
+	rdpid on x86) without a system call.
+
+	@return The CPU index, or -1 if unknown.
 	*/
-	inline void destroy();
+	static int getCurrentCpu()
+	{
+#if defined(USE_WINDOWS_TIMERS)
+		return static_cast<int>(GetCurrentProcessorNumber());
+#elif defined(__linux__)
+		return sched_getcpu();
+#else
+		return -1;
+#endif
+	}
 
 	/**
-	Prints an error message to standard output.
+	Returns the NUMA node of each CPU.
 
-	@param msg The string to print.
+	@return The node index of each CPU, indexed by CPU.
 	*/
-	inline void printError(const std::string& msg) const;
+	static std::vector<int> getCpuNodes()
+	{
+		std::vector<int> nodes;
+#if defined(USE_WINDOWS_TIMERS)
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		nodes.resize(info.dwNumberOfProcessors, 0);
+		for (size_t cpu = 0; cpu < nodes.size() && cpu < 256; ++cpu)
+		{
+			UCHAR node = 0;
+			if (GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node)) nodes[cpu] = node;
+		}
+#elif defined(__linux__)
+		// Each node lists its CPUs as ranges, e.g. "0-3,8-11".  Node 
+		// numbers can have gaps, so check a generous range.
+		for (int node = 0; node < 1024; ++node)
+		{
+			std::ostringstream filename;
+			filename << "/sys/devices/system/node/node" << node << "/cpulist";
+			std::ifstream file(filename.str().c_str());
+			if (!file.is_open()) continue;
+
+			std::string range;
+			while (std::getline(file, range, ','))
+			{
+				int first = 0;
+				int last = 0;
+				char dash = 0;
+				std::istringstream iss(range);
+				if (!(iss >> first)) continue;
+				if (!(iss >> dash >> last) || '-' != dash) last = first;
+				if (last >= static_cast<int>(nodes.size())) nodes.resize(last + 1, 0);
+				for (int cpu = first; cpu <= last; ++cpu) nodes[cpu] = node;
+			}
+		}
+#endif
+		return nodes;
+	}
 
 	/**
-	Returns a named profile block.
+	Checks whether block times could be skewed when a thread migrates 
+	between CPUs.  On Linux, if the kernel's clock source is the TSC but 
+	the CPUs don't advertise an invariant TSC (constant_tsc and 
+	nonstop_tsc), readings taken on different cores may disagree.
 
-	@param name The name of the block to return.
-	@return     The named ProfileBlock, or NULL if it can't be found.
+	@return A warning message, or an empty string if there's no problem.
 	*/
-	inline ProfileBlock* getProfileBlock(const std::string& name) const;
+	static std::string getClockSkewWarning()
+	{
+#if defined(__linux__)
+		std::ifstream clocksource(
+			"/sys/devices/system/clocksource/clocksource0/current_clocksource");
+		std::string source;
+		if (!(clocksource >> source) || "tsc" != source) return "";
+
+		std::ifstream cpuinfo("/proc/cpuinfo");
+		std::string line;
+		while (std::getline(cpuinfo, line))
+		{
+			if (0 != line.compare(0, 5, "flags")) continue;
+			line += " ";
+			if (std::string::npos == line.find(" constant_tsc ") || 
+				std::string::npos == line.find(" nonstop_tsc "))
+			{
+				return "The TSC clock source is not invariant on this machine; "
+					"times of blocks that migrate between CPUs may be skewed.";
+			}
+			break;
+		}
+#endif
+		return "";
+	}
+};
+
+/// A set of ways to represent timing results.
+enum TimeFormat
+{
+	SECONDS,
+	MILLISECONDS,
+	MICROSECONDS,
+	PERCENT
+};
+
+/// A set of ways to weight the stacks written by 
+/// Profiler::writeFoldedStacks.
+enum StackWeight
+{
+	/// Time (in us) spent in the block itself, excluding nested blocks.  
+	/// This is what flame graph tools expect: they sum nested stacks, so 
+	/// the rendered frame widths equal wall time.
+	SELF_TIME,
+
+	/// Total wall time (in us) spent in the block, including nested 
+	/// blocks.
+	WALL_TIME,
+
+	/// The number of times the block was entered.
+	CALL_COUNT
+};
+
+/// A set of ways to compress the data output file.
+enum Compression
+{
+	/// Plain text, flushed after every line (the default).
+	UNCOMPRESSED,
 
+	/// Concatenated gzip members.  Requires QUICKPROF_USE_ZLIB.
+	GZIP,
+
+	/// Concatenated zstd frames.  Requires QUICKPROF_USE_ZSTD.
+	ZSTD,
+
+	/// The built-in LZ codec (see LzCodec).  Always available.
+	BUILTIN_LZ,
+
+	/// The best available format: ZSTD, then GZIP, then BUILTIN_LZ.
+	AUTO_COMPRESSION
+};
+
+/// A small LZ77-style codec used to compress the data output file when 
+/// neither zlib nor zstd is available.  Compressed files are a sequence 
+/// of independent frames, each starting with a 12-byte header: the 
+/// magic bytes "QPLZ", the uncompressed size and the compressed size 
+/// (both 32-bit little-endian).
+class LzCodec
+{
+public:
 	/**
-	Returns the appropriate suffix string for the given time format.
+	Compresses a block of data and appends it to the output string as a 
+	single frame, including the frame header.
 
-	@return The suffix string.
+	@param data The data to compress.
+	@param size The number of bytes to compress.
+	@param out  The string to which the frame is appended.
 	*/
-	inline std::string getSuffixString(TimeFormat format) const;
+	static void compressFrame(const char* data, size_t size, std::string& out)
+	{
+		size_t headerPos = out.size();
+		out.append("QPLZ");
+		appendUint32(out, static_cast<unsigned int>(size));
+		appendUint32(out, 0);
 
-	/// Determines whether the profiler is enabled.
-	bool mEnabled;
+		// A hash table of recent positions, indexed by the hash of the 
+		// next four bytes.  Position 0 doubles as the empty marker, 
+		// which only costs us a possible match at the very start.
+		const unsigned int hashBits = 12;
+		std::vector<size_t> table(static_cast<size_t>(1) << hashBits, 0);
 
-	/// The clock used to time profile blocks.
-	Clock mClock;
+		size_t anchor = 0;
+		size_t pos = 0;
 
-	/// The starting time (in us) of the current profiling cycle.
-	unsigned long long int mCurrentCycleStartMicroseconds;
+		// The last 12 bytes are always emitted as literals, which keeps 
+		// the reads below in bounds and the final sequence literal-only.
+		if (size > 12)
+		{
+			const size_t searchLimit = size - 12;
+			const size_t matchLimit = size - 5;
+			while (pos < searchLimit)
+			{
+				unsigned int sequence = readUint32(data + pos);
+				unsigned int hash = (sequence * 2654435761u) >> (32 - hashBits);
+				size_t candidate = table[hash];
+				table[hash] = pos;
 
-	/// The average profiling cycle duration (in us).  If smoothing is 
-	/// disabled, this is the same as the duration of the most recent 
-	/// cycle.
-	double mAvgCycleDurationMicroseconds;
+				if (candidate > 0 && pos - candidate <= 65535 && 
+					readUint32(data + candidate) == sequence)
+				{
+					size_t length = 4;
+					while (pos + length < matchLimit && 
+						data[candidate + length] == data[pos + length])
+					{
+						++length;
+					}
 
-	/// Internal map of named profile blocks.
-	typedef std::map<std::string, ProfileBlock*> ProfileBlocks;
-	ProfileBlocks mBlocks;
+					appendSequence(out, data + anchor, pos - anchor, 
+						pos - candidate, length);
+					pos += length;
+					anchor = pos;
+				}
+				else ++pos;
+			}
+		}
 
-	/// The data output file used if this feature is enabled in init.
-	std::ofstream mOutputFile;
+		appendSequence(out, data + anchor, size - anchor, 0, 0);
 
-	/// Tracks whether we have begun printing data to the output file.
-	bool mFirstFileOutput;
+		unsigned int compressedSize = 
+			static_cast<unsigned int>(out.size() - headerPos - 12);
+		for (int i = 0; i < 4; ++i)
+		{
+			out[headerPos + 8 + i] = static_cast<char>((compressedSize >> (8 * i)) & 0xff);
+		}
+	}
 
-	/// A pre-computed scalar used to update exponentially-weighted moving 
-	/// averages.
-	double mMovingAvgScalar;
+	/**
+	Decompresses a sequence of frames produced by compressFrame.
 
-	/// Determines how often (in number of profiling cycles) timing data 
-	/// is printed to the output file.
-	size_t mPrintPeriod;
+	@param data The compressed data.
+	@param size The number of compressed bytes.
+	@param out  The string to which the decompressed data is appended.
+	@return     False if the data is truncated or corrupt.
+	*/
+	static bool decompress(const char* data, size_t size, std::string& out)
+	{
+		size_t pos = 0;
+		while (pos < size)
+		{
+			if (size - pos < 12 || 0 != std::memcmp(data + pos, "QPLZ", 4)) return false;
+			size_t rawSize = readUint32(data + pos + 4);
+			size_t compressedSize = readUint32(data + pos + 8);
+			pos += 12;
+			if (size - pos < compressedSize) return false;
+			if (!decompressSequences(data + pos, compressedSize, rawSize, out)) return false;
+			pos += compressedSize;
+		}
+		return true;
+	}
 
-	/// The time format used when printing timing data to the output file.
-	TimeFormat mPrintFormat;
+	/**
+	Decompresses a file written with the BUILTIN_LZ compression format.
 
-	/// Keeps track of how many cycles have elapsed (for printing).
-	size_t mCycleCounter;
+	@param filename The compressed file.
+	@param out      The stream that receives the decompressed text.
+	@return         False if the file cannot be read or is corrupt.
+	*/
+	static bool decompressFile(const std::string& filename, std::ostream& out)
+	{
+		std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+		if (!file.is_open()) return false;
+		std::string data((std::istreambuf_iterator<char>(file)), 
+			std::istreambuf_iterator<char>());
+		std::string text;
+		if (!decompress(data.data(), data.size(), text)) return false;
+		out << text;
+		return true;
+	}
 
-	/// Used to update the initial average cycle times.
-	bool mFirstCycle;
-};
+private:
+	static unsigned int readUint32(const char* p)
+	{
+		const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+		return static_cast<unsigned int>(u[0]) | (static_cast<unsigned int>(u[1]) << 8) | 
+			(static_cast<unsigned int>(u[2]) << 16) | (static_cast<unsigned int>(u[3]) << 24);
+	}
 
-Profiler::Profiler() :
-	mEnabled(false),
-	mClock(),
-	mCurrentCycleStartMicroseconds(0),
-	mAvgCycleDurationMicroseconds(0),
-	mBlocks(),
-	mOutputFile(),
-	mFirstFileOutput(true),
-	mMovingAvgScalar(0),
-	mPrintPeriod(1),
-	mPrintFormat(SECONDS),
-	mCycleCounter(0),
-	mFirstCycle(true)
-{
-	// do nothing
-}
+	static void appendUint32(std::string& out, unsigned int value)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+		}
+	}
 
-Profiler::~Profiler()
-{
-	// This is called when the program exits because the singleton 
-	// instance is static.
+	static void appendLength(std::string& out, size_t length)
+	{
+		while (length >= 255)
+		{
+			out.push_back(static_cast<char>(255));
+			length -= 255;
+		}
+		out.push_back(static_cast<char>(length));
+	}
 
-	destroy();
-}
+	/// Appends one sequence: a token byte holding the literal and match 
+	/// lengths, the literals, then the match offset.  A zero matchLength 
+	/// marks the final, literal-only sequence.
+	static void appendSequence(std::string& out, const char* literals, 
+		size_t numLiterals, size_t offset, size_t matchLength)
+	{
+		size_t matchCode = matchLength > 0 ? matchLength - 4 : 0;
+		unsigned char token = static_cast<unsigned char>(
+			((numLiterals < 15 ? numLiterals : 15) << 4) | 
+			(matchCode < 15 ? matchCode : 15));
+		out.push_back(static_cast<char>(token));
+		if (numLiterals >= 15) appendLength(out, numLiterals - 15);
+		out.append(literals, numLiterals);
+		if (0 == matchLength) return;
+		out.push_back(static_cast<char>(offset & 0xff));
+		out.push_back(static_cast<char>((offset >> 8) & 0xff));
+		if (matchCode >= 15) appendLength(out, matchCode - 15);
+	}
 
-Profiler& Profiler::instance()
-{
-	static Profiler self;
-	return self;
-}
+	static bool readLength(const unsigned char* data, size_t size, 
+		size_t& pos, size_t& length)
+	{
+		unsigned char b = 255;
+		while (255 == b)
+		{
+			if (pos >= size) return false;
+			b = data[pos++];
+			length += b;
+		}
+		return true;
+	}
 
-void Profiler::destroy()
-{
-	mEnabled = false;
-	mClock.reset();
-	mCurrentCycleStartMicroseconds = 0;
-	mAvgCycleDurationMicroseconds = 0;
-	for (ProfileBlocks::iterator iter = mBlocks.begin(); iter != mBlocks.end(); ++iter)
+	static bool decompressSequences(const char* src, size_t size, 
+		size_t rawSize, std::string& out)
 	{
-		delete iter->second;
-		iter->second = NULL;
+		const unsigned char* data = reinterpret_cast<const unsigned char*>(src);
+		const size_t start = out.size();
+		out.reserve(start + rawSize);
+		size_t pos = 0;
+		while (pos < size)
+		{
+			unsigned char token = data[pos++];
+			size_t numLiterals = token >> 4;
+			if (15 == numLiterals && !readLength(data, size, pos, numLiterals)) return false;
+			if (size - pos < numLiterals) return false;
+			out.append(src + pos, numLiterals);
+			pos += numLiterals;
+
+			// The final sequence has no match.
+			if (pos == size) break;
+
+			if (size - pos < 2) return false;
+			size_t offset = data[pos] | (static_cast<size_t>(data[pos + 1]) << 8);
+			pos += 2;
+			size_t matchLength = token & 0x0f;
+			if (15 == matchLength && !readLength(data, size, pos, matchLength)) return false;
+			matchLength += 4;
+			if (0 == offset || offset > out.size() - start) return false;
+
+			// Copy byte by byte since the match may overlap itself.
+			size_t from = out.size() - offset;
+			for (size_t i = 0; i < matchLength; ++i)
+			{
+				out.push_back(out[from + i]);
+			}
+		}
+		return out.size() - start == rawSize;
 	}
-	mBlocks.clear();
-	if (mOutputFile.is_open()) mOutputFile.close();
-	mFirstFileOutput = true;
-	mMovingAvgScalar = 0;
-	mPrintPeriod = 1;
-	mPrintFormat = SECONDS;
-	mCycleCounter = 0;
-	mFirstCycle = true;
-}
+};
 
-void Profiler::init(double smoothing, const std::string& outputFilename, 
-	size_t printPeriod, TimeFormat printFormat)
+/// The data output file.  Supports optional size- and time-based 
+/// rotation and streaming compression.  When compression is enabled, 
+/// lines are buffered and compressed in chunks (on a background thread 
+/// if available); each chunk is an independent gzip member, zstd frame 
+/// or LzCodec frame, so every file can be decompressed on its own.
+class OutputFile
 {
-	if (mEnabled)
+public:
+	OutputFile() : 
+		mMaxBytes(0),
+		mMaxMicroseconds(0),
+		mMaxFiles(0),
+		mCompression(UNCOMPRESSED),
+		mActiveCompression(UNCOMPRESSED),
+		mFilename(),
+		mIsOpen(false),
+		mFileBytes(0),
+		mFileStartMicroseconds(0),
+		mLastSubmitMicroseconds(0),
+		mBuffer(),
+		mStream()
+#ifdef USE_STD_THREADS
+		,
+		mJobs(),
+		mMutex(),
+		mCondition(),
+		mThread(),
+		mStopThread(false)
+#endif
 	{
-		// Reset everything to its initial state and re-initialize.
-		destroy();
-		std::cout << "[QuickProf] Re-initializing profiler, " 
-			<< "erasing all profiling blocks" << std::endl;
+		// do nothing
 	}
 
-	mEnabled = true;
+	~OutputFile()
+	{
+		close();
+	}
 
-	if (smoothing <= 0)
+	/**
+	Sets the rotation limits.  A limit of zero disables that limit.
+
+	@param maxBytes        The maximum number of bytes of text written to 
+	                       each file (measured before compression).
+	@param maxMicroseconds The maximum time span covered by each file.
+	@param maxFiles        The maximum number of rotated files to keep, 
+	                       or zero to keep them all.
+	*/
+	void setRotation(unsigned long long maxBytes, 
+		unsigned long long maxMicroseconds, size_t maxFiles)
 	{
-		if (smoothing < 0) printError("Smoothing parameter must be >= 0. Using 0.");
-		mMovingAvgScalar = 0;
+		mMaxBytes = maxBytes;
+		mMaxMicroseconds = maxMicroseconds;
+		mMaxFiles = maxFiles;
 	}
-	else
+
+	/**
+	Sets the compression format used for files opened after this call.
+
+	@param compression The compression format.
+	*/
+	void setCompression(Compression compression)
 	{
-		// Treat smoothing as a time constant.
-		mMovingAvgScalar = ::exp(-1 / smoothing);
+		mCompression = compression;
+	}
+
+	/**
+	Opens the output file.  If rotation is enabled, an existing file is 
+	rotated out of the way instead of being overwritten.
+
+	@param filename The base file name.  Compressed files get an 
+	                extension for their format (e.g. ".gz").
+	@param now      The current time (in us).
+	@return         False if the file could not be opened.
+	*/
+	bool open(const std::string& filename, unsigned long long now)
+	{
+		close();
+
+		mActiveCompression = resolveCompression(mCompression);
+		mFilename = filename + getExtension(mActiveCompression);
+		mFileBytes = 0;
+		mFileStartMicroseconds = now;
+		mLastSubmitMicroseconds = now;
+
+		if (isRotationEnabled())
+		{
+			std::ifstream existing(mFilename.c_str());
+			if (existing.is_open())
+			{
+				existing.close();
+				shiftFiles();
+			}
+		}
+
+		openStream();
+		mIsOpen = mStream.is_open();
+
+#ifdef USE_STD_THREADS
+		if (mIsOpen && UNCOMPRESSED != mActiveCompression)
+		{
+			mStopThread = false;
+			mThread = std::thread(&OutputFile::threadMain, this);
+		}
+#endif
+
+		return mIsOpen;
+	}
+
+	/// Returns true if the file is open.
+	bool isOpen() const
+	{
+		return mIsOpen;
+	}
+
+	/// Returns true if nothing has been written to the current file yet, 
+	/// i.e. a header line is needed.
+	bool isEmpty() const
+	{
+		return 0 == mFileBytes;
+	}
+
+	/**
+	Starts a new file if the current one has exceeded its size or time 
+	limit.  This should be called before writing a header line.
+
+	@param now The current time (in us).
+	*/
+	void rotateIfNeeded(unsigned long long now)
+	{
+		if (!mIsOpen || 0 == mFileBytes) return;
+
+		bool rotate = (mMaxBytes > 0 && mFileBytes >= mMaxBytes) || 
+			(mMaxMicroseconds > 0 && now - mFileStartMicroseconds >= mMaxMicroseconds);
+		if (!rotate) return;
+
+		submit(true);
+		mFileBytes = 0;
+		mFileStartMicroseconds = now;
+	}
+
+	/**
+	Writes text to the current file.
+
+	@param text The text to write.
+	@param now  The current time (in us).
+	*/
+	void write(const std::string& text, unsigned long long now)
+	{
+		if (!mIsOpen) return;
+
+		mFileBytes += text.size();
+
+		if (UNCOMPRESSED == mActiveCompression)
+		{
+			mStream << text;
+			mStream.flush();
+			return;
+		}
+
+		// Compress in large chunks to get a good compression ratio, but 
+		// don't hold on to data for too long in case the process dies.
+		mBuffer += text;
+		if (mBuffer.size() >= CHUNK_BYTES || now - mLastSubmitMicroseconds >= 
+			CHUNK_MICROSECONDS)
+		{
+			submit(false);
+			mLastSubmitMicroseconds = now;
+		}
+	}
+
+	/// Flushes any buffered data and closes the file.
+	void close()
+	{
+		if (!mIsOpen) return;
+
+		if (UNCOMPRESSED != mActiveCompression) submit(false);
+
+#ifdef USE_STD_THREADS
+		if (mThread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStopThread = true;
+			}
+			mCondition.notify_one();
+			mThread.join();
+		}
+#endif
+
+		mStream.close();
+		mIsOpen = false;
+		mFileBytes = 0;
+	}
+
+private:
+	/// The amount of text compressed at a time.
+	static const size_t CHUNK_BYTES = 256 * 1024;
+
+	/// The maximum time (in us) text is buffered before being compressed.
+	static const unsigned long long CHUNK_MICROSECONDS = 10000000;
+
+	/// A chunk of text waiting to be compressed, and whether the file 
+	/// should be rotated after writing it.
+	struct Job
+	{
+		std::string text;
+		bool rotate;
+	};
+
+	bool isRotationEnabled() const
+	{
+		return mMaxBytes > 0 || mMaxMicroseconds > 0 || mMaxFiles > 0;
+	}
+
+	static Compression resolveCompression(Compression compression)
+	{
+		switch(compression)
+		{
+			case GZIP:
+#ifdef QUICKPROF_USE_ZLIB
+				return GZIP;
+#else
+				std::cout << "[QuickProf error] GZIP output requires " 
+					<< "QUICKPROF_USE_ZLIB. Using BUILTIN_LZ." << std::endl;
+				return BUILTIN_LZ;
+#endif
+			case ZSTD:
+#ifdef QUICKPROF_USE_ZSTD
+				return ZSTD;
+#else
+				std::cout << "[QuickProf error] ZSTD output requires " 
+					<< "QUICKPROF_USE_ZSTD. Using BUILTIN_LZ." << std::endl;
+				return BUILTIN_LZ;
+#endif
+			case AUTO_COMPRESSION:
+#if defined(QUICKPROF_USE_ZSTD)
+				return ZSTD;
+#elif defined(QUICKPROF_USE_ZLIB)
+				return GZIP;
+#else
+				return BUILTIN_LZ;
+#endif
+			default: return compression;
+		}
+	}
+
+	static std::string getExtension(Compression compression)
+	{
+		std::string extension;
+		switch(compression)
+		{
+			case GZIP: extension=".gz"; break;
+			case ZSTD: extension=".zst"; break;
+			case BUILTIN_LZ: extension=".qlz"; break;
+			default: break;
+		}
+		return extension;
+	}
+
+	/// Returns the name of the rotated file with the given index.
+	std::string getRotatedFilename(size_t index) const
+	{
+		std::string base = mFilename.substr(0, mFilename.size() - 
+			getExtension(mActiveCompression).size());
+		std::ostringstream oss;
+		oss << base << "." << index << getExtension(mActiveCompression);
+		return oss.str();
+	}
+
+	/// Renames file.N to file.N+1 (deleting the oldest beyond the limit), 
+	/// and the current file to file.1.  The current file must be closed.
+	void shiftFiles()
+	{
+		size_t last = 1;
+		if (mMaxFiles > 0)
+		{
+			std::remove(getRotatedFilename(mMaxFiles).c_str());
+			last = mMaxFiles;
+		}
+		else
+		{
+			// Keep everything; find the first unused index.
+			while (true)
+			{
+				std::ifstream existing(getRotatedFilename(last).c_str());
+				if (!existing.is_open()) break;
+				++last;
+			}
+		}
+
+		for (size_t i = last; i > 1; --i)
+		{
+			std::rename(getRotatedFilename(i - 1).c_str(), 
+				getRotatedFilename(i).c_str());
+		}
+		std::rename(mFilename.c_str(), getRotatedFilename(1).c_str());
+	}
+
+	/// Hands the buffered text to the compressor, optionally followed by 
+	/// a rotation.
+	void submit(bool rotate)
+	{
+		if (UNCOMPRESSED == mActiveCompression)
+		{
+			if (rotate) rotateFile();
+			return;
+		}
+
+		Job job;
+		job.text.swap(mBuffer);
+		job.rotate = rotate;
+
+#ifdef USE_STD_THREADS
+		if (mThread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mJobs.push_back(Job());
+				mJobs.back().text.swap(job.text);
+				mJobs.back().rotate = rotate;
+			}
+			mCondition.notify_one();
+			return;
+		}
+#endif
+
+		runJob(job);
+	}
+
+	void runJob(const Job& job)
+	{
+		if (!job.text.empty())
+		{
+			std::string compressed;
+			compress(job.text, compressed);
+			mStream.write(compressed.data(), compressed.size());
+			mStream.flush();
+		}
+		if (job.rotate) rotateFile();
+	}
+
+	void rotateFile()
+	{
+		mStream.close();
+		shiftFiles();
+		openStream();
+	}
+
+	void openStream()
+	{
+		std::ios::openmode mode = std::ios::out | std::ios::trunc;
+		if (UNCOMPRESSED != mActiveCompression) mode |= std::ios::binary;
+		mStream.open(mFilename.c_str(), mode);
+	}
+
+	void compress(const std::string& text, std::string& out) const
+	{
+		switch(mActiveCompression)
+		{
+#ifdef QUICKPROF_USE_ZLIB
+			case GZIP:
+			{
+				// Each chunk is a complete gzip member.  Concatenated 
+				// members form a valid gzip file.
+				z_stream stream;
+				std::memset(&stream, 0, sizeof(stream));
+				if (Z_OK != deflateInit2(&stream, Z_DEFAULT_COMPRESSION, 
+					Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)) break;
+				out.resize(deflateBound(&stream, static_cast<uLong>(text.size())) + 32);
+				stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+				stream.avail_in = static_cast<uInt>(text.size());
+				stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+				stream.avail_out = static_cast<uInt>(out.size());
+				deflate(&stream, Z_FINISH);
+				out.resize(stream.total_out);
+				deflateEnd(&stream);
+				break;
+			}
+#endif
+#ifdef QUICKPROF_USE_ZSTD
+			case ZSTD:
+			{
+				out.resize(ZSTD_compressBound(text.size()));
+				size_t size = ZSTD_compress(&out[0], out.size(), text.data(), 
+					text.size(), 3);
+				out.resize(ZSTD_isError(size) ? 0 : size);
+				break;
+			}
+#endif
+			default: LzCodec::compressFrame(text.data(), text.size(), out); break;
+		}
+	}
+
+#ifdef USE_STD_THREADS
+	void threadMain()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (true)
+		{
+			mCondition.wait(lock, [this] { return mStopThread || !mJobs.empty(); });
+			if (mJobs.empty()) break;
+
+			Job job;
+			job.text.swap(mJobs.front().text);
+			job.rotate = mJobs.front().rotate;
+			mJobs.erase(mJobs.begin());
+
+			lock.unlock();
+			runJob(job);
+			lock.lock();
+		}
+	}
+#endif
+
+	/// Rotation limits (zero means unlimited).
+	unsigned long long mMaxBytes;
+	unsigned long long mMaxMicroseconds;
+	size_t mMaxFiles;
+
+	/// The requested compression format.
+	Compression mCompression;
+
+	/// The compression format of the open file.
+	Compression mActiveCompression;
+
+	/// The name of the current file, including the extension.
+	std::string mFilename;
+
+	bool mIsOpen;
+
+	/// The number of bytes of text written to the current file.
+	unsigned long long mFileBytes;
+
+	/// The time (in us) the current file was started.
+	unsigned long long mFileStartMicroseconds;
+
+	/// The time (in us) text was last handed to the compressor.
+	unsigned long long mLastSubmitMicroseconds;
+
+	/// Text waiting to be compressed.
+	std::string mBuffer;
+
+	std::ofstream mStream;
+
+#ifdef USE_STD_THREADS
+	/// Chunks waiting for the background thread.  The stream is only 
+	/// touched by the background thread while it is running.
+	std::vector<Job> mJobs;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::thread mThread;
+	bool mStopThread;
+#endif
+};
+
+/// The accumulated totals of one block in a ProfileSnapshot.
+struct SnapshotBlock
+{
+	SnapshotBlock() :
+		name(),
+		totalMicroseconds(0),
+		totalCpuMicroseconds(0),
+		totalVoluntarySwitches(0),
+		totalInvoluntarySwitches(0),
+		numCalls(0)
+	{
+		// do nothing
+	}
+
+	/// The block name.
+	std::string name;
+
+	/// See the ProfileBlock fields of the same names.
+	unsigned long long int totalMicroseconds;
+	unsigned long long int totalCpuMicroseconds;
+	unsigned long long int totalVoluntarySwitches;
+	unsigned long long int totalInvoluntarySwitches;
+	unsigned long long int numCalls;
+};
+
+/// An immutable copy of a Profiler's block totals at one point in time 
+/// (see Profiler::getSnapshot).
+/// 
+/// Snapshots can be subtracted to get the totals over an interval, 
+/// added to combine several profilers, and serialized to combine the 
+/// results of several processes (e.g. workers after fork).  Blocks are 
+/// kept sorted by name, so these operations take linear time.
+class ProfileSnapshot
+{
+public:
+	ProfileSnapshot() :
+		mBlocks(),
+		mElapsedMicroseconds(0)
+	{
+		// do nothing
+	}
+
+	/**
+	Returns the time (in us) covered by the snapshot: the time since the 
+	profiler was initialized, or the sum of the times of merged 
+	snapshots.  This is the base for PERCENT results.
+
+	@return The elapsed time.
+	*/
+	unsigned long long int getElapsedMicroseconds() const
+	{
+		return mElapsedMicroseconds;
+	}
+
+	/// Returns the number of blocks.
+	size_t getNumBlocks() const
+	{
+		return mBlocks.size();
+	}
+
+	/**
+	Returns a block by index.  Blocks are sorted by name.
+
+	@param i The block index, which must be < getNumBlocks().
+	@return  The block.
+	*/
+	const SnapshotBlock& getBlock(size_t i) const
+	{
+		return mBlocks[i];
+	}
+
+	/**
+	Finds a block by name.
+
+	@param name The block name.
+	@return     The block, or NULL if it doesn't exist.
+	*/
+	const SnapshotBlock* findBlock(const std::string& name) const
+	{
+		size_t first = 0;
+		size_t last = mBlocks.size();
+		while (first < last)
+		{
+			size_t middle = first + (last - first) / 2;
+			if (mBlocks[middle].name < name) first = middle + 1;
+			else last = middle;
+		}
+		if (first < mBlocks.size() && mBlocks[first].name == name) return &mBlocks[first];
+		return NULL;
+	}
+
+	/**
+	Combines two snapshots, adding up the totals of blocks with the same 
+	name and the elapsed times.
+
+	@param other The other snapshot.
+	@return      The combined snapshot.
+	*/
+	ProfileSnapshot operator+(const ProfileSnapshot& other) const
+	{
+		return combine(other, true);
+	}
+
+	/**
+	Returns the difference from an earlier snapshot of the same 
+	profiler, i.e. the totals over the interval between them.  Totals 
+	that would be negative (e.g. if the profiler was re-initialized) are 
+	clamped to zero.
+
+	@param earlier The earlier snapshot.
+	@return        The difference.
+	*/
+	ProfileSnapshot operator-(const ProfileSnapshot& earlier) const
+	{
+		return combine(earlier, false);
+	}
+
+	/**
+	Returns a summary of total times in each block, in the same format 
+	as Profiler::getSummary.
+
+	@param format The desired time format to use for the results.
+	@return       The timing summary as a string.
+	*/
+	std::string getSummary(TimeFormat format=PERCENT) const
+	{
+		std::ostringstream oss;
+		for (size_t i = 0; i < mBlocks.size(); ++i)
+		{
+			if (i > 0) oss << "\n";
+			double total = static_cast<double>(mBlocks[i].totalMicroseconds);
+			double result = 0;
+			std::string suffix;
+			switch(format)
+			{
+				case SECONDS: result=total*0.000001; suffix="s"; break;
+				case MILLISECONDS: result=total*0.001; suffix="ms"; break;
+				case MICROSECONDS: result=total; suffix="us"; break;
+				case PERCENT:
+				{
+					if (0 != mElapsedMicroseconds) result=100.0*total/mElapsedMicroseconds;
+					suffix="%";
+					break;
+				}
+				default: break;
+			}
+			oss << mBlocks[i].name << ": " << result << " " << suffix;
+		}
+		return oss.str();
+	}
+
+	/**
+	Writes the snapshot as text, to be read back with deserialize.
+
+	@param out The stream to write to.
+	*/
+	void serialize(std::ostream& out) const
+	{
+		out << "# QuickProf snapshot 1\n";
+		out << "elapsed(us) " << mElapsedMicroseconds << "\n";
+		out << "# total(us) cpu(us) voluntary involuntary calls name\n";
+		for (size_t i = 0; i < mBlocks.size(); ++i)
+		{
+			const SnapshotBlock& block = mBlocks[i];
+			out << block.totalMicroseconds << " " << block.totalCpuMicroseconds 
+				<< " " << block.totalVoluntarySwitches << " " 
+				<< block.totalInvoluntarySwitches << " " << block.numCalls << " " 
+				<< block.name << "\n";
+		}
+	}
+
+	/**
+	Reads a snapshot written by serialize.
+
+	@param in       The stream to read from.
+	@param snapshot Receives the snapshot.
+	@return         False if the data is not a valid snapshot.
+	*/
+	static bool deserialize(std::istream& in, ProfileSnapshot& snapshot)
+	{
+		std::string line;
+		if (!std::getline(in, line) || "# QuickProf snapshot 1" != line) return false;
+
+		ProfileSnapshot result;
+		std::string label;
+		if (!std::getline(in, line)) return false;
+		std::istringstream elapsed(line);
+		if (!(elapsed >> label >> result.mElapsedMicroseconds)) return false;
+
+		while (std::getline(in, line))
+		{
+			if (line.empty() || '#' == line[0]) continue;
+			SnapshotBlock block;
+			std::istringstream iss(line);
+			if (!(iss >> block.totalMicroseconds >> block.totalCpuMicroseconds >> 
+				block.totalVoluntarySwitches >> block.totalInvoluntarySwitches >> 
+				block.numCalls)) return false;
+
+			// The name is the rest of the line, after one space.
+			iss.get();
+			std::getline(iss, block.name);
+			if (block.name.empty()) return false;
+			if (!result.mBlocks.empty() && !(result.mBlocks.back().name < block.name)) 
+				return false;
+			result.mBlocks.push_back(block);
+		}
+
+		snapshot = result;
+		return true;
+	}
+
+private:
+	friend class Profiler;
+
+	static unsigned long long int combine(unsigned long long int a, 
+		unsigned long long int b, bool add)
+	{
+		if (add) return a + b;
+		return a > b ? a - b : 0;
+	}
+
+	static void combine(SnapshotBlock& block, const SnapshotBlock& other, bool add)
+	{
+		block.totalMicroseconds = combine(block.totalMicroseconds, 
+			other.totalMicroseconds, add);
+		block.totalCpuMicroseconds = combine(block.totalCpuMicroseconds, 
+			other.totalCpuMicroseconds, add);
+		block.totalVoluntarySwitches = combine(block.totalVoluntarySwitches, 
+			other.totalVoluntarySwitches, add);
+		block.totalInvoluntarySwitches = combine(block.totalInvoluntarySwitches, 
+			other.totalInvoluntarySwitches, add);
+		block.numCalls = combine(block.numCalls, other.numCalls, add);
+	}
+
+	/// Merges the sorted block lists in one pass.
+	ProfileSnapshot combine(const ProfileSnapshot& other, bool add) const
+	{
+		ProfileSnapshot result;
+		result.mElapsedMicroseconds = combine(mElapsedMicroseconds, 
+			other.mElapsedMicroseconds, add);
+		result.mBlocks.reserve(mBlocks.size() + other.mBlocks.size());
+
+		size_t i = 0;
+		size_t j = 0;
+		while (i < mBlocks.size() || j < other.mBlocks.size())
+		{
+			if (j == other.mBlocks.size() || 
+				(i < mBlocks.size() && mBlocks[i].name < other.mBlocks[j].name))
+			{
+				result.mBlocks.push_back(mBlocks[i++]);
+			}
+			else if (i == mBlocks.size() || other.mBlocks[j].name < mBlocks[i].name)
+			{
+				// Blocks missing from this snapshot count as zero.
+				SnapshotBlock block;
+				block.name = other.mBlocks[j].name;
+				combine(block, other.mBlocks[j++], add);
+				result.mBlocks.push_back(block);
+			}
+			else
+			{
+				result.mBlocks.push_back(mBlocks[i++]);
+				combine(result.mBlocks.back(), other.mBlocks[j++], add);
+			}
+		}
+		return result;
+	}
+
+	/// The blocks, sorted by name.
+	std::vector<SnapshotBlock> mBlocks;
+
+	/// The time (in us) covered by the snapshot.
+	unsigned long long int mElapsedMicroseconds;
+};
+
+/// A singleton class that manages timing for a set of profiling blocks.
+class Profiler
+{
+public:
+	/**
+	Useful for creating multiple Profiler instances.
+
+	Normally the Profiler class should be accessed only through the 
+	singleton instance method, which provides global access to a single 
+	static Profiler instance.  However, it is also possible to create 
+	several local Profiler instances, if necessary.
+	*/
+	inline Profiler();
+
+	inline ~Profiler();
+
+	/**
+	Accesses the singleton instance.
+
+	@return The Profiler instance.
+	*/
+	inline static Profiler& instance();
+
+	/**
+	Initializes the profiler. 
+
+	This must be called first.  If this is never called, the profiler 
+	is effectively disabled, and all other functions will return 
+	immediately.  This can be called more than once to re-initialize the 
+	profiler, which erases all previous profiling block names and their 
+	timing data.
+
+	@param smoothing      The measured duration for each profile 
+                            block can be averaged across multiple 
+                            cycles, and this parameter defines the 
+                            smoothness of this averaging process.
+                            The higher the value, the smoother the 
+                            resulting average durations will appear.  
+                            Leaving it at zero will essentially 
+                            disable the smoothing effect.  More 
+                            specifically, this parameter is a time 
+                            constant (defined in terms of cycles) that 
+                            defines an exponentially-weighted moving 
+                            average.  For example, a value of 4.0 
+                            means the past four cycles will contribute 
+                            63% of the current weighted average.  This 
+                            value must be >= 0.
+	@param outputFilename If defined, enables timing data to be 
+                            printed to a data file for later analysis.
+	@param printPeriod    Defines how often data is printed to the 
+                            file, in number of profiling cycles.  For 
+                            example, set this to 1 if you want data 
+                            printed after each cycle, or 5 if you want 
+                            it printed every 5 cycles.  It is a good 
+                            idea to increase this if you don't want 
+                            huge data files.  Keep in mind, however, 
+                            that when you increase this, you might 
+                            want to increase the smoothing 
+                            parameter.  (A good heuristic is to set 
+                            the smoothing parameter equal to the 
+                            print period.)  This value must be >= 1.
+	@param printFormat    Defines the format used when printing data 
+                            to a file.
+	*/
+	inline void init(double smoothing=0.0, 
+		const std::string& outputFilename="", size_t printPeriod=1,
+		TimeFormat printFormat=MILLISECONDS);
+
+	/**
+	Enables rotation of the data output file, for long-running processes.
+
+	When a limit is reached, the current file is renamed to 
+	"<outputFilename>.1" (shifting older files to .2, .3, etc.) and a 
+	new file is started with its own header line.  If rotation is 
+	enabled, an existing output file is rotated out of the way on init 
+	instead of being overwritten.  This must be called before init, 
+	and the setting is kept when the profiler is re-initialized.
+
+	@param maxBytes   The maximum amount of text (in bytes, measured 
+	                    before compression) written to each file, or 
+	                    zero for no size limit.
+	@param maxSeconds The maximum time span covered by each file, or 
+	                    zero for no time limit.
+	@param maxFiles   The number of rotated files to keep.  Older files 
+	                    are deleted.  Zero keeps all files.
+	*/
+	inline void setOutputRotation(unsigned long long maxBytes, 
+		double maxSeconds=0, size_t maxFiles=0);
+
+	/**
+	Enables compression of the data output file.
+
+	Compressed output is buffered and written in chunks, and the file 
+	name gets an extension for the format (e.g. "results.dat.gz").  
+	This must be called before init, and the setting is kept when the 
+	profiler is re-initialized.
+
+	@param compression The compression format.
+	*/
+	inline void setOutputCompression(Compression compression);
+
+	/**
+	Enables measuring the thread CPU time and context switches of each 
+	block, in addition to its wall time.
+
+	This shows whether a slow block is busy on the CPU or blocked 
+	(on I/O, locks, page faults, etc.).  It costs system calls at the 
+	start and end of each block, so it is disabled by default.  This 
+	must not be called within a timing block.  The setting is kept 
+	when the profiler is re-initialized.
+
+	@param enabled Whether CPU timing is enabled.
+	*/
+	inline void setCpuTiming(bool enabled);
+
+	/**
+	Enables tracking which CPU and NUMA node each block runs on.
+
+	For each block this records how many updates migrated to a different 
+	CPU or NUMA node between beginBlock and endBlock, and how the block's 
+	time is distributed across CPUs and nodes (see getPlacementReport).  
+	Time is attributed to the CPU the block update started on.  When 
+	enabled, this also warns if the clock could be skewed across CPUs.  
+	This must not be called within a timing block.  The setting is kept 
+	when the profiler is re-initialized.
+
+	@param enabled Whether placement tracking is enabled.
+	*/
+	inline void setPlacementTracking(bool enabled);
+
+	/**
+	Begins timing the named block of code.
+
+	@param name The name of the block.
+	*/
+	inline void beginBlock(const std::string& name);
+
+	/**
+	Defines the end of the named timing block.
+
+	@param name The name of the block.
+	*/
+	inline void endBlock(const std::string& name);
+
+	/**
+	Returns a handle to the named block, creating the block if necessary.
+
+	Timing a block through its handle skips the name lookup, and if the 
+	block is disabled (see enableBlocks) it costs a single branch.  For 
+	example: 
+	static quickprof::ProfileBlock* fooBlock = PROFILER.getBlockHandle("foo");
+	PROFILER.beginBlock(fooBlock);
+	foo();
+	PROFILER.endBlock(fooBlock);
+
+	Handles remain valid for the lifetime of the profiler.  
+	Re-initializing the profiler erases its blocks from all reports, 
+	but a block whose handle is used again reappears with its 
+	statistics reset.  A handle may be taken before the profiler is 
+	initialized; its block is timed once the profiler is initialized.
+
+	@param name The name of the block.
+	@return     The block handle.
+	*/
+	inline ProfileBlock* getBlockHandle(const std::string& name);
+
+	/**
+	Begins timing a block of code.
+
+	@param block The block handle (see getBlockHandle).
+	*/
+	inline void beginBlock(ProfileBlock* block);
+
+	/**
+	Defines the end of a timing block.
+
+	@param block The block handle (see getBlockHandle).
+	*/
+	inline void endBlock(ProfileBlock* block);
+
+	/**
+	Begins timing a block of code, attaching arguments to this update.
+
+	Arguments are stored as plain values, so nothing is allocated or 
+	formatted here.  They are recorded in the event trace (see 
+	setEventTrace) and can be used to aggregate the block's time by 
+	value (see setArgAggregation).  When exported, a placeholder "{0}" or 
+	"{1}" in the block name is replaced by the corresponding argument, 
+	and other arguments are appended with a ':' separator.  For example, 
+	a block named "query:{0}" with the argument 
+	PROFILER.internString("users") is exported as "query:users".
+
+	@param block The block handle (see getBlockHandle).
+	@param arg0  The first argument.
+	@param arg1  The optional second argument.
+	*/
+	inline void beginBlock(ProfileBlock* block, const BlockArg& arg0, 
+		const BlockArg& arg1=BlockArg());
+
+	/**
+	Registers a string so it can be attached to blocks as an argument.
+
+	This allocates the first time a string is seen, so it is meant to be 
+	called outside of hot code and the result cached, e.g. once per 
+	table name.  Interned strings are kept when the profiler is 
+	re-initialized.
+
+	@param str The string.
+	@return    The interned string.
+	*/
+	inline InternedString internString(const std::string& str);
+
+	/**
+	Enables aggregating a block's time by the value of one of its 
+	arguments, e.g. per table name.  The time for each value is reported 
+	by getSummary.
+
+	The number of distinct values is capped to keep memory bounded; the 
+	time of values beyond the cap, and of updates without the key 
+	argument, is aggregated as "<other>".  All slots are allocated here, 
+	so the block updates never allocate.  Each update scans the slots 
+	linearly, so its cost grows with maxVariants; keep it small (e.g. a 
+	few dozen).  This must be called after init and not within a timing 
+	block.
+
+	@param block       The block handle (see getBlockHandle).
+	@param argIndex    The index of the argument used as the key.
+	@param maxVariants The maximum number of distinct values.
+	*/
+	inline void setArgAggregation(ProfileBlock* block, size_t argIndex, 
+		size_t maxVariants);
+
+	/**
+	Enables recording each block update (its start time, duration and 
+	arguments) in an event trace.
+
+	The trace is a ring buffer holding the most recent updates; it is 
+	allocated here, so recording never allocates.  The setting is kept 
+	when the profiler is re-initialized, but the trace is cleared.
+
+	@param capacity The number of updates to keep, or zero to disable 
+	                the trace.
+	*/
+	inline void setEventTrace(size_t capacity);
+
+	/**
+	Writes the event trace, oldest update first, one update per line: 
+	the start time and duration (in us) and the formatted block name 
+	with its arguments.
+
+	@param out The stream to write to.
+	*/
+	inline void writeEventTrace(std::ostream& out) const;
+
+	/**
+	Adds time measured elsewhere to a block, e.g. by a Benchmark.  
+	This counts as one block update.  This must not be called within a 
+	timing block for the same block.
+
+	@param block        The block handle (see getBlockHandle).
+	@param microseconds The time to add (in us).
+	*/
+	inline void addBlockTime(ProfileBlock* block, 
+		unsigned long long int microseconds);
+
+	/**
+	Returns a snapshot of the current block totals (see ProfileSnapshot).
+
+	@return The snapshot.
+	*/
+	inline ProfileSnapshot getSnapshot() const;
+
+	/**
+	Adds the blocks of another profiler into this one, reconciling blocks 
+	by name and creating any that don't exist yet.
+
+	The totals, CPU times, context switches and placement counters are 
+	added up, so e.g. the results of one profiler per subsystem can be 
+	combined.  PERCENT results stay relative to this profiler's time 
+	since init.  The per-cycle averages are not merged, since the two 
+	profilers' cycles don't line up; neither are the call trees, 
+	argument aggregation and event traces.  This takes linear time in 
+	the number of blocks, and must not be called within a timing block.  
+	The other profiler must not be in use by another thread, and this 
+	profiler must be initialized.
+
+	@param other The profiler to merge into this one.
+	*/
+	inline void merge(const Profiler& other);
+
+	/**
+	Adds the block totals of a snapshot into this profiler, e.g. one 
+	read from a worker process with ProfileSnapshot::deserialize.  
+	Blocks are reconciled by name in linear time, and the snapshot's 
+	totals are added to the blocks' totals only (not to the per-cycle 
+	averages).  This must not be called within a timing block, and this 
+	profiler must be initialized.
+
+	@param snapshot The snapshot to merge into this profiler.
+	*/
+	inline void merge(const ProfileSnapshot& snapshot);
+
+	/**
+	Enables timing of the blocks matching a pattern.
+
+	Blocks are enabled or disabled by a list of rules, checked in 
+	order, where the last matching rule wins.  Blocks that match no rule 
+	are enabled, unless the first rule is an enable rule, in which case 
+	only the blocks matching an enable rule are timed.  Patterns may 
+	contain the wildcards '*' (any characters) and '?' (any single 
+	character), so "render.*" matches every block whose name starts 
+	with "render.".  Disabled blocks are not timed and don't appear in 
+	the call tree; since nesting is not known ahead of time, subtrees 
+	are best selected with a common name prefix.
+
+	Rules can also be read from a control file (see setBlockFilterFile) 
+	and from the QUICKPROF_BLOCKS environment variable, which is read 
+	at each init.  The environment rules are checked after all other 
+	rules, so they win.  The other rules are kept when the profiler is 
+	re-initialized.  This must not be called within a timing block.
+
+	@param pattern The block name pattern.
+	*/
+	inline void enableBlocks(const std::string& pattern);
+
+	/**
+	Disables timing of the blocks matching a pattern (see enableBlocks).
+
+	@param pattern The block name pattern.
+	*/
+	inline void disableBlocks(const std::string& pattern);
+
+	/**
+	Replaces all block filtering rules, except those from the 
+	QUICKPROF_BLOCKS environment variable (see enableBlocks).
+
+	@param rules A list of patterns separated by commas or new lines.  
+	             A pattern starting with '-' disables the matching 
+	             blocks; otherwise (optionally with a leading '+') it 
+	             enables them.  Lines starting with '#' are ignored.  
+	             An empty list enables all blocks.
+	*/
+	inline void setBlockFilters(const std::string& rules);
+
+	/**
+	Sets a control file from which the block filtering rules are read 
+	(see setBlockFilters for the format).  The file is read immediately, 
+	and re-read every checkPeriod profiling cycles; whenever its 
+	contents change, they replace the current rules (as with 
+	setBlockFilters).  This lets you switch on detailed timing in a 
+	running process.
+
+	@param filename    The control file, or an empty string to stop 
+	                     checking.
+	@param checkPeriod How often (in number of profiling cycles) the 
+	                     file is checked.  This value must be >= 1.
+	*/
+	inline void setBlockFilterFile(const std::string& filename, 
+		size_t checkPeriod=100);
+
+	/**
+	Defines the end of a profiling cycle. 
+
+	Use this regularly by calling it at the end of all timing blocks.  
+	This is necessary for smoothing and for file output, but not if 
+	you just want a total summary at the end of execution (i.e. from 
+	getSummary).  This must not be called within a timing block.
+	*/
+	inline void endCycle();
+
+	/**
+	Returns the average time used in the named block per profiling cycle.
+		
+	If smoothing is disabled (see init), this returns the most recent 
+	duration measurement.
+
+	@param name   The name of the block.
+	@param format The desired time format to use for the result.
+	@return       The block's average duration per cycle.
+	*/
+	inline double getAvgDuration(const std::string& name, 
+		TimeFormat format) const;
+
+	/**
+	Returns the total time spent in the named block since the profiler was 
+	initialized.
+
+	@param name   The name of the block.
+	@param format The desired time format to use for the result.
+	@return       The block total time.
+	*/
+	inline double getTotalDuration(const std::string& name, 
+		TimeFormat format) const;
+
+	/**
+	Returns the total CPU time used by the thread in the named block 
+	since the profiler was initialized (see setCpuTiming).  If all of 
+	the block's time was measured with CPU timing enabled, the difference 
+	from getTotalDuration is the time spent off-CPU.
+
+	@param name   The name of the block.
+	@param format The desired time format to use for the result.
+	@return       The block total CPU time.
+	*/
+	inline double getCpuDuration(const std::string& name, 
+		TimeFormat format) const;
+
+	/**
+	Returns the number of context switches in the named block since the 
+	profiler was initialized (see setCpuTiming).  Voluntary switches 
+	happen when the thread blocks; involuntary switches happen when it 
+	is preempted.  These are only counted on Linux.
+
+	@param name      The name of the block.
+	@param voluntary Whether to return voluntary or involuntary switches.
+	@return          The number of context switches.
+	*/
+	inline unsigned long long int getNumContextSwitches(
+		const std::string& name, bool voluntary) const;
+
+	/**
+	Returns a report of where each block ran (see setPlacementTracking): 
+	the number of updates that migrated between CPUs and NUMA nodes, and 
+	the block's time on each CPU and node.
+
+	@param format The desired time format to use for the results.
+	@return       The placement report as a string.
+	*/
+	inline std::string getPlacementReport(TimeFormat format=MILLISECONDS) const;
+
+	/**
+	Computes the elapsed time since the profiler was initialized.
+
+	@param format The desired time format to use for the result.
+	@return The elapsed time.
+	*/
+	inline double getTimeSinceInit(TimeFormat format) const;
+
+	/**
+	Returns a summary of total times in each block.
+
+	@param format The desired time format to use for the results.
+	@return       The timing summary as a string.
+	*/
+	inline std::string getSummary(TimeFormat format=PERCENT) const;
+
+	/**
+	Returns the number of blocks currently defined (e.g. for iterating).
+
+	@return The number of blocks.
+	*/
+	inline size_t getNumBlocks() const;
+
+	/**
+	Returns the name of a block (e.g. for iterating).
+
+	@param i The block index.
+	@return  The block name as a string, or empty string if index is invalid.
+	*/
+	inline const std::string& getBlockName(size_t i) const;
+
+	/**
+	Writes the stacks of nested blocks in the folded format used by 
+	flamegraph.pl, speedscope and similar tools: one "a;b;c <weight>" 
+	line per distinct stack.
+
+	The stacks are tracked as blocks begin and end, so this can be 
+	called at any time, e.g. after endCycle.  Nesting is taken from the 
+	order of beginBlock/endBlock calls.  To export several profilers 
+	(e.g. one per thread) into one file, give each a different root 
+	frame to keep them apart, or the same root frame (or none) to merge 
+	them; the tools add up identical stacks.
+
+	@param out       The stream to write to.
+	@param weight    The value written for each stack.
+	@param rootFrame If defined, a frame prepended to every stack.
+	*/
+	inline void writeFoldedStacks(std::ostream& out, 
+		StackWeight weight=SELF_TIME, const std::string& rootFrame="") const;
+
+#ifdef USE_STD_THREADS
+	/**
+	Returns the statistics for a named lock, creating them if necessary.
+
+	This is used by the instrumented mutex wrappers (see Mutex), and is 
+	safe to call from any thread.  The statistics remain valid for the 
+	lifetime of the Profiler, including across re-initialization.  At 
+	each endCycle, the lock's wait and hold times are added to the 
+	blocks "<name>.wait" and "<name>.hold", so they show up in the 
+	output file and summary like any other block.
+
+	@param name The name of the lock.
+	@return     The lock statistics.
+	*/
+	inline LockStats* getLockStats(const std::string& name);
+
+	/**
+	Returns a report of the contention on each named lock: the number of 
+	acquisitions, the fraction that had to wait, the total wait and hold 
+	times, and a histogram of wait times.  This is safe to call from any 
+	thread.
+
+	@param format The desired time format to use for the results.
+	@return       The lock report as a string.
+	*/
+	inline std::string getLockReport(TimeFormat format=MILLISECONDS) const;
+
+	/**
+	Begins an instance of a parallel region, i.e. a section of code 
+	whose work is split across several threads.
+
+	This is called by the thread that distributes the work, and also 
+	begins timing a block with the same name.  Each participating thread 
+	(including this one, if it works too) marks its work with 
+	beginRegionWork/endRegionWork.  This must not be called within a 
+	timing block that is ended before endParallelRegion.
+
+	@param name The name of the region.
+	*/
+	inline void beginParallelRegion(const std::string& name);
+
+	/**
+	Ends an instance of a parallel region, once all participating 
+	threads have finished.
+
+	This computes the region's load imbalance: the busiest thread's 
+	busy time divided by the mean busy time of all participating 
+	threads.  The busiest thread is the straggler.  The time the other 
+	threads spent idle while waiting for the straggler (the straggler's 
+	busy time minus each thread's busy time, summed) is added to the 
+	block "<name>.idle".  The time the region ran beyond the straggler's 
+	busy time is dispatch overhead (see getRegionReport).
+
+	@param name The name of the region.
+	*/
+	inline void endParallelRegion(const std::string& name);
+
+	/**
+	Begins a piece of work in a parallel region on the calling thread.  
+	This is safe to call from any thread.  A thread can do several 
+	pieces of work per region instance; their times are added up.
+
+	This locks a mutex shared by all threads, which can distort the 
+	busy times of short pieces of work.  For fine-grained work, use a 
+	region handle instead.
+
+	@param name The name of the region.
+	*/
+	inline void beginRegionWork(const std::string& name);
+
+	/**
+	Ends a piece of work in a parallel region on the calling thread.  
+	This is safe to call from any thread.
+
+	@param name The name of the region.
+	*/
+	inline void endRegionWork(const std::string& name);
+
+	/**
+	Returns a handle to the named parallel region, creating the region 
+	if necessary, with a slot for each of a fixed set of workers (e.g. 
+	the threads of a thread pool).
+
+	Timing work through the handle skips the name lookup and doesn't 
+	lock anything: each worker only writes to its own slot.  For 
+	example: 
+	static quickprof::ParallelRegion* pool = PROFILER.getRegionHandle("pool", 8);
+	// On worker thread i:
+	PROFILER.beginRegionWork(pool, i);
+	doWork();
+	PROFILER.endRegionWork(pool, i);
+
+	Handles remain valid for the lifetime of the profiler.  The number 
+	of workers can only grow while no region instance is running.
+
+	@param name       The name of the region.
+	@param numWorkers The number of worker slots.
+	@return           The region handle.
+	*/
+	inline ParallelRegion* getRegionHandle(const std::string& name, 
+		size_t numWorkers);
+
+	/**
+	Begins a piece of work in a parallel region on a worker.  Each 
+	worker must only be used by one thread at a time.
+
+	@param region The region handle (see getRegionHandle).
+	@param worker The worker index, less than the number of workers.
+	*/
+	inline void beginRegionWork(ParallelRegion* region, size_t worker);
+
+	/**
+	Ends a piece of work in a parallel region on a worker.
+
+	@param region The region handle (see getRegionHandle).
+	@param worker The worker index, less than the number of workers.
+	*/
+	inline void endRegionWork(ParallelRegion* region, size_t worker);
+
+	/**
+	Returns the average load imbalance (max/mean busy time per thread) 
+	of the named parallel region per instance.  A value of 1 means the 
+	work is perfectly balanced.
+
+	If smoothing is disabled (see init), this returns the mean over the 
+	most recent profiling cycle.
+
+	@param name The name of the region.
+	@return     The average imbalance, or zero if the region is unknown.
+	*/
+	inline double getAvgImbalance(const std::string& name) const;
+
+	/**
+	Returns a report of each parallel region with instances since the 
+	profiler was initialized: the number of instances, the average and 
+	worst load imbalance, the total idle time, the total dispatch 
+	overhead, and the straggler threads or workers.
+
+	@param format The desired time format to use for the results.
+	@return       The region report as a string.
+	*/
+	inline std::string getRegionReport(TimeFormat format=MILLISECONDS) const;
+#endif
+
+private:
+	/**
+	Returns everything to its initial state.
+
+	Deallocates memory, closes output files, and resets all variables.  
+	This is called when the profiler is re-initialized and when the 
+	process exits.
+	*/
+	inline void destroy();
+
+	/**
+	Prints an error message to standard output.
+
+	@param msg The string to print.
+	*/
+	inline void printError(const std::string& msg) const;
+
+	/**
+	Returns a named profile block.
+
+	@param name The name of the block to return.
+	@return     The named ProfileBlock, or NULL if it can't be found.
+	*/
+	inline ProfileBlock* getProfileBlock(const std::string& name) const;
+
+	/**
+	Returns the appropriate suffix string for the given time format.
+
+	@return The suffix string.
+	*/
+	inline std::string getSuffixString(TimeFormat format) const;
+
+	/**
+	Converts a total time (e.g. since init) to the given time format.
+
+	@param microseconds The time in microseconds.
+	@param format       The desired time format to use for the result.
+	@return             The converted time.
+	*/
+	inline double convertTotalDuration(double microseconds, 
+		TimeFormat format) const;
+
+	/**
+	Returns a named profile block, creating it if necessary.
+
+	@param name The name of the block to return.
+	@return     The named ProfileBlock.
+	*/
+	inline ProfileBlock* getOrCreateProfileBlock(const std::string& name);
+
+	/**
+	Returns a new block for the given name: the retired block of that 
+	name if there is one, or else a newly allocated block.  The caller 
+	adds it to mBlocks.
+
+	@param name The name of the block.
+	@return     The block.
+	*/
+	inline ProfileBlock* newProfileBlock(const std::string& name);
+
+	/**
+	Adds a retired block back to mBlocks (see ProfileBlock::retired).
+
+	@param block The retired block.
+	*/
+	inline void restoreProfileBlock(ProfileBlock* block);
+
+	/**
+	Finishes timing a block.
+
+	@param block   The block.
+	@param endTick The end time (in us).
+	*/
+	inline void endBlock(ProfileBlock* block, unsigned long long int endTick);
+
+	/**
+	Starts timing a block once it is known to be enabled.
+
+	@param block The block.
+	*/
+	inline void startBlock(ProfileBlock* block);
+
+	/**
+	Formats a block name with its arguments (see beginBlock).
+
+	@param name    The block name.
+	@param args    The arguments.
+	@param numArgs The number of arguments.
+	@return        The formatted name.
+	*/
+	inline std::string formatBlockName(const std::string& name, 
+		const BlockArg* args, size_t numArgs) const;
+
+	/**
+	Replaces an argument's placeholder in a block name, or appends the 
+	argument if there is no placeholder.
+
+	@param name  The block name.
+	@param index The argument index.
+	@param value The formatted argument.
+	*/
+	inline static void substituteArg(std::string& name, size_t index, 
+		const std::string& value);
+
+	/// A rule that enables or disables the blocks matching a pattern.
+	struct BlockFilter
+	{
+		std::string pattern;
+		bool enable;
+	};
+
+	/**
+	Parses a list of block filtering rules (see setBlockFilters).
+
+	@param rules   The list of rules.
+	@param filters Receives the rules, appended in order.
+	*/
+	inline static void parseBlockFilters(const std::string& rules, 
+		std::vector<BlockFilter>& filters);
+
+	/**
+	Returns whether a block name is enabled by the filtering rules.  No 
+	blocks are enabled while the profiler is not initialized.
+
+	@param name The block name.
+	@return     True if the block should be timed.
+	*/
+	inline bool isBlockEnabled(const std::string& name) const;
+
+	/**
+	Re-applies the filtering rules to all blocks.
+	*/
+	inline void applyBlockFilters();
+
+	/**
+	Reads the block filter control file and applies it if it changed.
+	*/
+	inline void checkBlockFilterFile();
+
+	/**
+	Matches a name against a pattern with '*' and '?' wildcards.
+
+	@param pattern The pattern.
+	@param name    The name to match.
+	@return        True if the name matches.
+	*/
+	inline static bool matchesPattern(const std::string& pattern, 
+		const std::string& name);
+
+#ifdef USE_STD_THREADS
+	/**
+	Adds the lock wait and hold times accumulated since the last call to 
+	the lock profile blocks.
+	*/
+	inline void collectLockTimes();
+
+	/**
+	Updates the per-cycle averages of the parallel regions.
+	*/
+	inline void updateRegions();
+
+	/**
+	Returns the work record of the calling thread in a region instance, 
+	creating it if necessary.  The regions mutex must be locked.
+
+	@param region The region.
+	@return       The calling thread's work record.
+	*/
+	inline ParallelRegion::ThreadWork& getThreadWork(ParallelRegion& region);
+#endif
+
+	/**
+	Writes the folded stacks for a call tree node and its children.
+
+	@param out    The stream to write to.
+	@param node   The node to write.
+	@param stack  The folded stack up to and including the node.
+	@param weight The value written for each stack.
+	*/
+	inline void writeFoldedStacks(std::ostream& out, const CallTreeNode* node, 
+		std::string& stack, StackWeight weight) const;
+
+	/// Determines whether the profiler is enabled.
+	bool mEnabled;
+
+	/// Determines whether thread CPU time is measured for each block.
+	bool mCpuTiming;
+
+	/// Determines whether the CPU and NUMA node are tracked for each block.
+	bool mPlacementTracking;
+
+	/// The NUMA node of each CPU, indexed by CPU.
+	std::vector<int> mCpuNodes;
+
+	/// The clock used to time profile blocks.
+	Clock mClock;
+
+	/// The starting time (in us) of the current profiling cycle.
+	unsigned long long int mCurrentCycleStartMicroseconds;
+
+	/// The average profiling cycle duration (in us).  If smoothing is 
+	/// disabled, this is the same as the duration of the most recent 
+	/// cycle.
+	double mAvgCycleDurationMicroseconds;
+
+	/// Internal map of named profile blocks.
+	typedef std::map<std::string, ProfileBlock*> ProfileBlocks;
+	ProfileBlocks mBlocks;
+
+	/// The blocks erased by re-initializing the profiler.  They are kept 
+	/// because their handles may still be used.
+	ProfileBlocks mRetiredBlocks;
+
+	/// The root of the call tree of nested blocks.
+	CallTreeNode mCallTreeRoot;
+
+	/// The call tree node of the innermost block currently being timed.
+	CallTreeNode* mCurrentNode;
+
+	/// The block returned by getBlockHandle for invalid block names.  It 
+	/// is always disabled.
+	ProfileBlock mDisabledBlock;
+
+	/// The strings registered with internString, indexed by id, and 
+	/// the ids of the strings.
+	std::vector<std::string> mInternedStrings;
+	std::map<std::string, unsigned int> mInternedStringIds;
+
+	/// A block update recorded in the event trace.
+	struct TraceEvent
+	{
+		ProfileBlock* block;
+		unsigned long long int startMicroseconds;
+		unsigned long long int durationMicroseconds;
+		BlockArg args[ProfileBlock::MAX_ARGS];
+		size_t numArgs;
+	};
+
+	/// The event trace ring buffer (empty if disabled), the index of the 
+	/// next event to write, and the number of events recorded.
+	std::vector<TraceEvent> mEventTrace;
+	size_t mEventTraceNext;
+	size_t mEventTraceSize;
+
+	/// The block filtering rules, in order.
+	std::vector<BlockFilter> mBlockFilters;
+
+	/// The block filtering rules from the QUICKPROF_BLOCKS environment 
+	/// variable, which are checked after mBlockFilters.
+	std::vector<BlockFilter> mEnvBlockFilters;
+
+	/// The block filter control file, if any.
+	std::string mBlockFilterFilename;
+
+	/// The last contents read from the block filter control file.
+	std::string mBlockFilterFileContents;
+
+	/// Determines how often (in number of profiling cycles) the block 
+	/// filter control file is checked.
+	size_t mBlockFilterCheckPeriod;
+
+	/// Keeps track of how many cycles have elapsed since the block filter 
+	/// control file was checked.
+	size_t mBlockFilterCheckCounter;
+
+	/// The data output file used if this feature is enabled in init.
+	OutputFile mOutputFile;
+
+	/// A pre-computed scalar used to update exponentially-weighted moving 
+	/// averages.
+	double mMovingAvgScalar;
+
+	/// Determines how often (in number of profiling cycles) timing data 
+	/// is printed to the output file.
+	size_t mPrintPeriod;
+
+	/// The time format used when printing timing data to the output file.
+	TimeFormat mPrintFormat;
+
+	/// Keeps track of how many cycles have elapsed (for printing).
+	size_t mCycleCounter;
+
+	/// Used to update the initial average cycle times.
+	bool mFirstCycle;
+
+#ifdef USE_STD_THREADS
+	/// Statistics for each named lock.
+	typedef std::map<std::string, LockStats*> Locks;
+	Locks mLocks;
+
+	/// Protects mLocks.
+	mutable std::mutex mLocksMutex;
+
+	/// Internal map of named parallel regions.
+	typedef std::map<std::string, ParallelRegion*> ParallelRegions;
+	ParallelRegions mRegions;
+
+	/// Protects mRegions.
+	mutable std::mutex mRegionsMutex;
+#endif
+};
+
+Profiler::Profiler() :
+	mEnabled(false),
+	mCpuTiming(false),
+	mPlacementTracking(false),
+	mCpuNodes(),
+	mClock(),
+	mCurrentCycleStartMicroseconds(0),
+	mAvgCycleDurationMicroseconds(0),
+	mBlocks(),
+	mRetiredBlocks(),
+	mCallTreeRoot(NULL, NULL, NULL),
+	mCurrentNode(&mCallTreeRoot),
+	mDisabledBlock(),
+	mInternedStrings(),
+	mInternedStringIds(),
+	mEventTrace(),
+	mEventTraceNext(0),
+	mEventTraceSize(0),
+	mBlockFilters(),
+	mEnvBlockFilters(),
+	mBlockFilterFilename(),
+	mBlockFilterFileContents(),
+	mBlockFilterCheckPeriod(100),
+	mBlockFilterCheckCounter(0),
+	mOutputFile(),
+	mMovingAvgScalar(0),
+	mPrintPeriod(1),
+	mPrintFormat(SECONDS),
+	mCycleCounter(0),
+	mFirstCycle(true)
+#ifdef USE_STD_THREADS
+	,
+	mLocks(),
+	mLocksMutex(),
+	mRegions(),
+	mRegionsMutex()
+#endif
+{
+	mDisabledBlock.enabled = false;
+}
+
+Profiler::~Profiler()
+{
+	// This is called when the program exits because the singleton 
+	// instance is static.
+
+	destroy();
+
+	for (ProfileBlocks::iterator iter = mRetiredBlocks.begin(); 
+		iter != mRetiredBlocks.end(); ++iter)
+	{
+		delete iter->second;
+	}
+
+#ifdef USE_STD_THREADS
+	for (Locks::iterator iter = mLocks.begin(); iter != mLocks.end(); ++iter)
+	{
+		delete iter->second;
+	}
+	for (ParallelRegions::iterator iter = mRegions.begin(); iter != mRegions.end(); ++iter)
+	{
+		delete iter->second;
+	}
+#endif
+}
+
+Profiler& Profiler::instance()
+{
+	static Profiler self;
+	return self;
+}
+
+void Profiler::destroy()
+{
+	mEnabled = false;
+	mClock.reset();
+	mCurrentCycleStartMicroseconds = 0;
+	mAvgCycleDurationMicroseconds = 0;
+
+	// Blocks are kept aside so that block handles stay valid.
+	for (ProfileBlocks::iterator iter = mBlocks.begin(); iter != mBlocks.end(); ++iter)
+	{
+		ProfileBlock* block = iter->second;
+		block->enabled = false;
+		block->retired = true;
+		block->reset();
+		block->name = &mRetiredBlocks.insert(
+			ProfileBlocks::value_type(iter->first, block)).first->first;
+	}
+	mBlocks.clear();
+	for (size_t i = 0; i < mCallTreeRoot.children.size(); ++i)
+	{
+		delete mCallTreeRoot.children[i];
+	}
+	mCallTreeRoot.children.clear();
+	mCurrentNode = &mCallTreeRoot;
+	mEventTraceNext = 0;
+	mEventTraceSize = 0;
+	mOutputFile.close();
+	mMovingAvgScalar = 0;
+	mPrintPeriod = 1;
+	mPrintFormat = SECONDS;
+	mCycleCounter = 0;
+	mFirstCycle = true;
+
+#ifdef USE_STD_THREADS
+	{
+		std::lock_guard<std::mutex> lock(mLocksMutex);
+		for (Locks::iterator iter = mLocks.begin(); iter != mLocks.end(); ++iter)
+		{
+			iter->second->enabled = false;
+			iter->second->reset();
+		}
+	}
+
+	// Regions are kept so that region handles stay valid.
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	for (ParallelRegions::iterator iter = mRegions.begin(); iter != mRegions.end(); ++iter)
+	{
+		iter->second->reset();
+	}
+#endif
+}
+
+void Profiler::init(double smoothing, const std::string& outputFilename, 
+	size_t printPeriod, TimeFormat printFormat)
+{
+	if (mEnabled)
+	{
+		// Reset everything to its initial state and re-initialize.
+		destroy();
+		std::cout << "[QuickProf] Re-initializing profiler, " 
+			<< "erasing all profiling blocks" << std::endl;
+	}
+
+	mEnabled = true;
+
+	if (smoothing <= 0)
+	{
+		if (smoothing < 0) printError("Smoothing parameter must be >= 0. Using 0.");
+		mMovingAvgScalar = 0;
+	}
+	else
+	{
+		// Treat smoothing as a time constant.
+		mMovingAvgScalar = ::exp(-1 / smoothing);
+	}
+
+	mClock.reset();
+
+	if (!outputFilename.empty() && !mOutputFile.open(outputFilename, 0))
+	{
+		printError("Cannot open output file '" + outputFilename + "'.");
+	}
+
+	if (printPeriod < 1)
+	{
+		printError("Print period must be >= 1. Using 1.");
+		mPrintPeriod = 1;
+	}
+	else mPrintPeriod = printPeriod;
+	mPrintFormat = printFormat;
+
+	mEnvBlockFilters.clear();
+	const char* blockFilters = std::getenv("QUICKPROF_BLOCKS");
+	if (blockFilters) parseBlockFilters(blockFilters, mEnvBlockFilters);
+	applyBlockFilters();
+
+	// Set the start time for the first cycle.
+	mCurrentCycleStartMicroseconds = mClock.getTimeMicroseconds();
+
+#ifdef USE_STD_THREADS
+	std::lock_guard<std::mutex> lock(mLocksMutex);
+	for (Locks::iterator iter = mLocks.begin(); iter != mLocks.end(); ++iter)
+	{
+		iter->second->enabled = true;
+	}
+#endif
+}
+
+void Profiler::setOutputRotation(unsigned long long maxBytes, 
+	double maxSeconds, size_t maxFiles)
+{
+	if (maxSeconds < 0)
+	{
+		printError("Rotation time must be >= 0. Using 0.");
+		maxSeconds = 0;
+	}
+	mOutputFile.setRotation(maxBytes, 
+		static_cast<unsigned long long>(maxSeconds * 1000000), maxFiles);
+}
+
+void Profiler::setOutputCompression(Compression compression)
+{
+	mOutputFile.setCompression(compression);
+}
+
+void Profiler::setCpuTiming(bool enabled)
+{
+	if (enabled && !CpuClock::isSupported())
+	{
+		printError("CPU timing is not supported on this platform.");
+		return;
+	}
+	mCpuTiming = enabled;
+}
+
+void Profiler::setPlacementTracking(bool enabled)
+{
+	if (enabled && !CpuPlacement::isSupported())
+	{
+		printError("Placement tracking is not supported on this platform.");
+		return;
+	}
+
+	if (enabled && !mPlacementTracking)
+	{
+		mCpuNodes = CpuPlacement::getCpuNodes();
+		std::string warning = CpuPlacement::getClockSkewWarning();
+		if (!warning.empty()) printError(warning);
+	}
+	mPlacementTracking = enabled;
+}
+
+void Profiler::beginBlock(const std::string& name)
+{
+	if (!mEnabled) return;
+
+	if (name.empty())
+	{
+		printError("Cannot allow unnamed profile blocks.");
+		return;
+	}
+
+	beginBlock(getOrCreateProfileBlock(name));
+}
+
+void Profiler::endBlock(const std::string& name)
+{
+	if (!mEnabled) return;
+
+	// We do this at the beginning to get more accurate results.
+	unsigned long long int endTick = mClock.getTimeMicroseconds();
+
+	ProfileBlock* block = getProfileBlock(name);
+	if (!block || !block->enabled) return;
+
+	endBlock(block, endTick);
+}
+
+ProfileBlock* Profiler::getBlockHandle(const std::string& name)
+{
+	if (name.empty())
+	{
+		printError("Cannot allow unnamed profile blocks.");
+		return &mDisabledBlock;
+	}
+
+	return getOrCreateProfileBlock(name);
+}
+
+void Profiler::beginBlock(ProfileBlock* block)
+{
+	if (!block->enabled) return;
+
+	block->currentNumArgs = 0;
+	startBlock(block);
+}
+
+void Profiler::beginBlock(ProfileBlock* block, const BlockArg& arg0, 
+	const BlockArg& arg1)
+{
+	if (!block->enabled) return;
+
+	block->currentArgs[0] = arg0;
+	block->currentArgs[1] = arg1;
+	block->currentNumArgs = BlockArg::NONE == arg1.type ? 1 : 2;
+	startBlock(block);
+}
+
+InternedString Profiler::internString(const std::string& str)
+{
+	std::map<std::string, unsigned int>::iterator iter = 
+		mInternedStringIds.find(str);
+	if (mInternedStringIds.end() != iter) return InternedString(iter->second);
+
+	unsigned int id = static_cast<unsigned int>(mInternedStrings.size());
+	mInternedStrings.push_back(str);
+	mInternedStringIds[str] = id;
+	return InternedString(id);
+}
+
+void Profiler::setArgAggregation(ProfileBlock* block, size_t argIndex, 
+	size_t maxVariants)
+{
+	if (argIndex >= ProfileBlock::MAX_ARGS)
+	{
+		printError("Invalid block argument index.");
+		return;
+	}
+	if (block == &mDisabledBlock) return;
+
+	block->variantArgIndex = argIndex;
+	block->variants.assign(maxVariants > 0 ? maxVariants + 1 : 0, BlockVariant());
+}
+
+void Profiler::setEventTrace(size_t capacity)
+{
+	mEventTrace.assign(capacity, TraceEvent());
+	mEventTraceNext = 0;
+	mEventTraceSize = 0;
+}
+
+void Profiler::writeEventTrace(std::ostream& out) const
+{
+	if (!mEnabled) return;
+
+	out << "# start(us) duration(us) block\n";
+	size_t index = (mEventTraceNext + mEventTrace.size() - mEventTraceSize) % 
+		(mEventTrace.empty() ? 1 : mEventTrace.size());
+	for (size_t i = 0; i < mEventTraceSize; ++i)
+	{
+		const TraceEvent& event = mEventTrace[index];
+		out << event.startMicroseconds << " " << event.durationMicroseconds 
+			<< " " << formatBlockName(*event.block->name, event.args, 
+			event.numArgs) << "\n";
+		if (++index == mEventTrace.size()) index = 0;
+	}
+}
+
+void Profiler::addBlockTime(ProfileBlock* block, 
+	unsigned long long int microseconds)
+{
+	if (!block->enabled) return;
+	if (block->retired) restoreProfileBlock(block);
+
+	block->currentCycleTotalMicroseconds += microseconds;
+	block->totalMicroseconds += microseconds;
+	++block->numCalls;
+}
+
+ProfileSnapshot Profiler::getSnapshot() const
+{
+	ProfileSnapshot snapshot;
+	if (!mEnabled) return snapshot;
+
+	snapshot.mElapsedMicroseconds = mClock.getTimeMicroseconds();
+	snapshot.mBlocks.reserve(mBlocks.size());
+	for (ProfileBlocks::const_iterator iter = mBlocks.begin(); iter != mBlocks.end(); ++iter)
+	{
+		const ProfileBlock* block = iter->second;
+		SnapshotBlock snapshotBlock;
+		snapshotBlock.name = iter->first;
+		snapshotBlock.totalMicroseconds = block->totalMicroseconds;
+		snapshotBlock.totalCpuMicroseconds = block->totalCpuMicroseconds;
+		snapshotBlock.totalVoluntarySwitches = block->totalVoluntarySwitches;
+		snapshotBlock.totalInvoluntarySwitches = block->totalInvoluntarySwitches;
+		snapshotBlock.numCalls = block->numCalls;
+		snapshot.mBlocks.push_back(snapshotBlock);
+	}
+	return snapshot;
+}
+
+void Profiler::merge(const Profiler& other)
+{
+	if (!mEnabled)
+	{
+		printError("Cannot merge into a profiler that is not initialized.");
+		return;
+	}
+	if (&other == this) return;
+
+	// Both maps are sorted by name, so walk them together and insert 
+	// missing blocks with a position hint (amortized constant time).
+	ProfileBlocks::iterator iter = mBlocks.begin();
+	ProfileBlocks::const_iterator otherIter = other.mBlocks.begin();
+	for (; otherIter != other.mBlocks.end(); ++otherIter)
+	{
+		while (mBlocks.end() != iter && iter->first < otherIter->first) ++iter;
+		if (mBlocks.end() == iter || otherIter->first < iter->first)
+		{
+			ProfileBlock* newBlock = newProfileBlock(otherIter->first);
+			iter = mBlocks.insert(iter, ProfileBlocks::value_type(
+				otherIter->first, newBlock));
+			newBlock->name = &iter->first;
+			newBlock->enabled = isBlockEnabled(iter->first);
+		}
+
+		ProfileBlock* block = iter->second;
+		const ProfileBlock* otherBlock = otherIter->second;
+		block->totalMicroseconds += otherBlock->totalMicroseconds;
+		block->numCalls += otherBlock->numCalls;
+		block->totalCpuMicroseconds += otherBlock->totalCpuMicroseconds;
+		block->totalVoluntarySwitches += otherBlock->totalVoluntarySwitches;
+		block->totalInvoluntarySwitches += otherBlock->totalInvoluntarySwitches;
+		block->numCpuSamples += otherBlock->numCpuSamples;
+		block->numPlacementSamples += otherBlock->numPlacementSamples;
+		block->numCpuMigrations += otherBlock->numCpuMigrations;
+		block->numNodeMigrations += otherBlock->numNodeMigrations;
+		block->numSkewedSamples += otherBlock->numSkewedSamples;
+
+		if (block->cpuMicroseconds.size() < otherBlock->cpuMicroseconds.size())
+		{
+			block->cpuMicroseconds.resize(otherBlock->cpuMicroseconds.size(), 0);
+		}
+		for (size_t i = 0; i < otherBlock->cpuMicroseconds.size(); ++i)
+		{
+			block->cpuMicroseconds[i] += otherBlock->cpuMicroseconds[i];
+		}
+		if (block->nodeMicroseconds.size() < otherBlock->nodeMicroseconds.size())
+		{
+			block->nodeMicroseconds.resize(otherBlock->nodeMicroseconds.size(), 0);
+		}
+		for (size_t i = 0; i < otherBlock->nodeMicroseconds.size(); ++i)
+		{
+			block->nodeMicroseconds[i] += otherBlock->nodeMicroseconds[i];
+		}
+	}
+}
+
+void Profiler::merge(const ProfileSnapshot& snapshot)
+{
+	if (!mEnabled)
+	{
+		printError("Cannot merge into a profiler that is not initialized.");
+		return;
+	}
+
+	ProfileBlocks::iterator iter = mBlocks.begin();
+	for (size_t i = 0; i < snapshot.mBlocks.size(); ++i)
+	{
+		const SnapshotBlock& snapshotBlock = snapshot.mBlocks[i];
+		while (mBlocks.end() != iter && iter->first < snapshotBlock.name) ++iter;
+		if (mBlocks.end() == iter || snapshotBlock.name < iter->first)
+		{
+			ProfileBlock* newBlock = newProfileBlock(snapshotBlock.name);
+			iter = mBlocks.insert(iter, ProfileBlocks::value_type(
+				snapshotBlock.name, newBlock));
+			newBlock->name = &iter->first;
+			newBlock->enabled = isBlockEnabled(iter->first);
+		}
+
+		ProfileBlock* block = iter->second;
+		block->totalMicroseconds += snapshotBlock.totalMicroseconds;
+		block->numCalls += snapshotBlock.numCalls;
+		block->totalCpuMicroseconds += snapshotBlock.totalCpuMicroseconds;
+		block->totalVoluntarySwitches += snapshotBlock.totalVoluntarySwitches;
+		block->totalInvoluntarySwitches += snapshotBlock.totalInvoluntarySwitches;
+
+		// Snapshots don't count CPU samples; assume all updates were 
+		// measured if any CPU time was.
+		if (snapshotBlock.totalCpuMicroseconds > 0)
+		{
+			block->numCpuSamples += snapshotBlock.numCalls;
+		}
+	}
+}
+
+void Profiler::startBlock(ProfileBlock* block)
+{
+	if (block->retired) restoreProfileBlock(block);
+
+	// Descend into the call tree, adding a node the first time this 
+	// stack is seen.
+	CallTreeNode* node = NULL;
+	std::vector<CallTreeNode*>& children = mCurrentNode->children;
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		if (children[i]->block == block)
+		{
+			node = children[i];
+			break;
+		}
+	}
+	if (!node)
+	{
+		node = new CallTreeNode(block->name, block, mCurrentNode);
+		children.push_back(node);
+	}
+	mCurrentNode = node;
+
+	if (mCpuTiming)
+	{
+		CpuUsage usage;
+		CpuClock::getUsage(usage);
+		block->currentBlockStartCpuMicroseconds = usage.cpuMicroseconds;
+		block->currentBlockStartVoluntarySwitches = usage.voluntarySwitches;
+		block->currentBlockStartInvoluntarySwitches = usage.involuntarySwitches;
+	}
+
+	if (mPlacementTracking) block->currentBlockStartCpu = CpuPlacement::getCurrentCpu();
+
+	// We do this at the end to get more accurate results.
+	block->currentBlockStartMicroseconds = mClock.getTimeMicroseconds();
+	node->startMicroseconds = block->currentBlockStartMicroseconds;
+}
+
+void Profiler::endBlock(ProfileBlock* block)
+{
+	if (!block->enabled) return;
+
+	// We do this at the beginning to get more accurate results.
+	endBlock(block, mClock.getTimeMicroseconds());
+}
+
+void Profiler::enableBlocks(const std::string& pattern)
+{
+	BlockFilter filter;
+	filter.pattern = pattern;
+	filter.enable = true;
+	mBlockFilters.push_back(filter);
+	applyBlockFilters();
+}
+
+void Profiler::disableBlocks(const std::string& pattern)
+{
+	BlockFilter filter;
+	filter.pattern = pattern;
+	filter.enable = false;
+	mBlockFilters.push_back(filter);
+	applyBlockFilters();
+}
+
+void Profiler::setBlockFilters(const std::string& rules)
+{
+	mBlockFilters.clear();
+	parseBlockFilters(rules, mBlockFilters);
+	applyBlockFilters();
+}
+
+void Profiler::parseBlockFilters(const std::string& rules, 
+	std::vector<BlockFilter>& filters)
+{
+	std::string::size_type start = 0;
+	while (start <= rules.size())
+	{
+		std::string::size_type end = rules.find_first_of(",\n", start);
+		if (std::string::npos == end) end = rules.size();
+
+		// Trim whitespace.
+		std::string::size_type first = rules.find_first_not_of(" \t\r", start);
+		std::string::size_type last = rules.find_last_not_of(" \t\r", end - 1);
+		if (std::string::npos != first && first < end && 
+			std::string::npos != last && last >= first && '#' != rules[first])
+		{
+			BlockFilter filter;
+			filter.enable = '-' != rules[first];
+			if ('-' == rules[first] || '+' == rules[first]) ++first;
+			filter.pattern = rules.substr(first, last + 1 - first);
+			if (!filter.pattern.empty()) filters.push_back(filter);
+		}
+
+		start = end + 1;
+	}
+}
+
+void Profiler::setBlockFilterFile(const std::string& filename, 
+	size_t checkPeriod)
+{
+	if (checkPeriod < 1)
+	{
+		printError("Block filter check period must be >= 1. Using 1.");
+		checkPeriod = 1;
+	}
+
+	mBlockFilterFilename = filename;
+	mBlockFilterFileContents.clear();
+	mBlockFilterCheckPeriod = checkPeriod;
+	mBlockFilterCheckCounter = 0;
+	if (!filename.empty()) checkBlockFilterFile();
+}
+
+void Profiler::endBlock(ProfileBlock* block, unsigned long long int endTick)
+{
+	// A block that ended before it started (e.g. due to unsynchronized 
+	// CPU clocks) is counted with a zero duration.
+	unsigned long long int blockDuration = 0;
+	if (endTick < block->currentBlockStartMicroseconds) ++block->numSkewedSamples;
+	else blockDuration = endTick - block->currentBlockStartMicroseconds;
+	block->currentCycleTotalMicroseconds += blockDuration;
+	block->totalMicroseconds += blockDuration;
+	++block->numCalls;
+
+	if (!block->variants.empty())
+	{
+		// Find the slot for this argument value, claiming an unused one 
+		// for a new value.  The last slot collects the overflow and the 
+		// updates without the key argument.
+		size_t last = block->variants.size() - 1;
+		size_t i = last;
+		if (block->variantArgIndex < block->currentNumArgs && 
+			BlockArg::NONE != block->currentArgs[block->variantArgIndex].type)
+		{
+			i = 0;
+		}
+		const BlockArg& key = block->currentArgs[block->variantArgIndex];
+		for (; i < last; ++i)
+		{
+			BlockVariant& variant = block->variants[i];
+			if (variant.key == key) break;
+			if (BlockArg::NONE == variant.key.type)
+			{
+				variant.key = key;
+				break;
+			}
+		}
+		block->variants[i].totalMicroseconds += blockDuration;
+		++block->variants[i].numCalls;
+	}
+
+	if (!mEventTrace.empty())
+	{
+		TraceEvent& event = mEventTrace[mEventTraceNext];
+		event.block = block;
+		event.startMicroseconds = block->currentBlockStartMicroseconds;
+		event.durationMicroseconds = blockDuration;
+		event.numArgs = block->currentNumArgs;
+		for (size_t i = 0; i < event.numArgs; ++i)
+		{
+			event.args[i] = block->currentArgs[i];
+		}
+		if (++mEventTraceNext == mEventTrace.size()) mEventTraceNext = 0;
+		if (mEventTraceSize < mEventTrace.size()) ++mEventTraceSize;
+	}
+
+	if (mCpuTiming)
+	{
+		CpuUsage usage;
+		CpuClock::getUsage(usage);
+		block->totalCpuMicroseconds += 
+			usage.cpuMicroseconds - block->currentBlockStartCpuMicroseconds;
+		block->totalVoluntarySwitches += 
+			usage.voluntarySwitches - block->currentBlockStartVoluntarySwitches;
+		block->totalInvoluntarySwitches += 
+			usage.involuntarySwitches - block->currentBlockStartInvoluntarySwitches;
+		++block->numCpuSamples;
+	}
+
+	if (mPlacementTracking && block->currentBlockStartCpu >= 0)
+	{
+		int startCpu = block->currentBlockStartCpu;
+		int endCpu = CpuPlacement::getCurrentCpu();
+		int startNode = startCpu < static_cast<int>(mCpuNodes.size()) ? mCpuNodes[startCpu] : 0;
+		int endNode = endCpu >= 0 && endCpu < static_cast<int>(mCpuNodes.size()) ? mCpuNodes[endCpu] : 0;
+
+		++block->numPlacementSamples;
+		if (endCpu != startCpu) ++block->numCpuMigrations;
+		if (endNode != startNode) ++block->numNodeMigrations;
+
+		// These only grow the first time a CPU or node is seen.
+		if (startCpu >= static_cast<int>(block->cpuMicroseconds.size()))
+		{
+			block->cpuMicroseconds.resize(startCpu + 1, 0);
+		}
+		if (startNode >= static_cast<int>(block->nodeMicroseconds.size()))
+		{
+			block->nodeMicroseconds.resize(startNode + 1, 0);
+		}
+		block->cpuMicroseconds[startCpu] += blockDuration;
+		block->nodeMicroseconds[startNode] += blockDuration;
+	}
+
+	// Pop the block off the call tree.  If inner blocks were left open, 
+	// close them here too; if the block isn't open, leave the tree alone.
+	CallTreeNode* node = mCurrentNode;
+	while (node->block && node->block != block) node = node->parent;
+	if (!node->block) return;
+	while (true)
+	{
+		CallTreeNode* closing = mCurrentNode;
+		unsigned long long int nodeDuration = endTick > closing->startMicroseconds ? 
+			endTick - closing->startMicroseconds : 0;
+		closing->totalMicroseconds += nodeDuration;
+		closing->parent->childMicroseconds += nodeDuration;
+		++closing->numCalls;
+		mCurrentNode = closing->parent;
+		if (closing == node) break;
+	}
+}
+
+void Profiler::endCycle()
+{
+	if (!mEnabled) return;
+
+#ifdef USE_STD_THREADS
+	collectLockTimes();
+	updateRegions();
+#endif
+
+	if (!mBlockFilterFilename.empty() && 
+		++mBlockFilterCheckCounter >= mBlockFilterCheckPeriod)
+	{
+		mBlockFilterCheckCounter = 0;
+		checkBlockFilterFile();
+	}
+
+	// Update the average total cycle time.
+	// On the first cycle we set the average cycle time equal to the 
+	// measured cycle time.  This avoids having to ramp up the average 
+	// from zero initially.
+	unsigned long long int currentCycleDurationMicroseconds = 
+		mClock.getTimeMicroseconds() - mCurrentCycleStartMicroseconds;
+	if (mFirstCycle)
+	{
+		mAvgCycleDurationMicroseconds = 
+			static_cast<double>(currentCycleDurationMicroseconds);
+	}
+	else
+	{
+		mAvgCycleDurationMicroseconds = mMovingAvgScalar * 
+			mAvgCycleDurationMicroseconds + (1 - mMovingAvgScalar) 
+			* static_cast<double>(currentCycleDurationMicroseconds);
+	}
+
+	// Update the average cycle time for each block.
+	ProfileBlocks::iterator blocksBegin = mBlocks.begin();
+	ProfileBlocks::iterator blocksEnd = mBlocks.end();
+	ProfileBlocks::iterator iter = blocksBegin;
+	for (; iter != blocksEnd; ++iter)
+	{
+		ProfileBlock* block = iter->second;
+
+		// On the first cycle we set the average cycle time equal to the 
+		// measured cycle time.  This avoids having to ramp up the average 
+		// from zero initially.
+		if (mFirstCycle)
+		{
+			block->avgCycleTotalMicroseconds = 
+				static_cast<double>(block->currentCycleTotalMicroseconds);
+		}
+		else
+		{
+			block->avgCycleTotalMicroseconds = mMovingAvgScalar * 
+				block->avgCycleTotalMicroseconds + (1 - mMovingAvgScalar) * 
+				static_cast<double>(block->currentCycleTotalMicroseconds);
+		}
+
+		block->currentCycleTotalMicroseconds = 0;
+	}
+
+	if (mFirstCycle) mFirstCycle = false;
+
+	// If enough cycles have passed, print data to the output file.
+	if (mOutputFile.isOpen() && mCycleCounter % mPrintPeriod == 0)
+	{
+		mCycleCounter = 0;
+
+		unsigned long long int now = mClock.getTimeMicroseconds();
+		mOutputFile.rotateIfNeeded(now);
+
+		std::ostringstream line;
+
+		if (mOutputFile.isEmpty())
+		{
+			// At the start of each file, print a header line that shows 
+			// the names of each data column (i.e. profiling block names).
+			line << "# t(s)";
+
+			std::string suffix = getSuffixString(mPrintFormat);
+			for (iter = blocksBegin; iter != blocksEnd; ++iter)
+			{
+				line << " " << (*iter).first << "(" << suffix << ")";
+			}
+
+			line << "\n";
+		}
+
+		line << getTimeSinceInit(SECONDS);
+
+		// Print the cycle time for each block.
+		for (iter = blocksBegin; iter != blocksEnd; ++iter)
+		{
+			line << " " << getAvgDuration((*iter).first, mPrintFormat);
+		}
+
+		line << "\n";
+		mOutputFile.write(line.str(), now);
+	}
+
+	++mCycleCounter;
+	mCurrentCycleStartMicroseconds = mClock.getTimeMicroseconds();
+}
+
+double Profiler::getAvgDuration(const std::string& name, TimeFormat format) const
+{
+	if (!mEnabled) return 0;
+
+	ProfileBlock* block = getProfileBlock(name);
+	if (!block) return 0;
+
+	double result=0;
+	switch(format)
+	{
+		case SECONDS: result=block->avgCycleTotalMicroseconds*0.000001; break;
+		case MILLISECONDS: result=block->avgCycleTotalMicroseconds*0.001; break;
+		case MICROSECONDS: result=block->avgCycleTotalMicroseconds; break;
+		case PERCENT:
+		{
+			if (0==mAvgCycleDurationMicroseconds) result=0;
+			else result=100.0*block->avgCycleTotalMicroseconds/mAvgCycleDurationMicroseconds;
+			break;
+		}
+		default: break;
+	}
+	return result;
+}
+
+double Profiler::getTotalDuration(const std::string& name, TimeFormat format) const
+{
+	if (!mEnabled) return 0;
+
+	ProfileBlock* block = getProfileBlock(name);
+	if (!block) return 0;
+
+	return convertTotalDuration(static_cast<double>(block->totalMicroseconds), 
+		format);
+}
+
+double Profiler::getCpuDuration(const std::string& name, TimeFormat format) const
+{
+	if (!mEnabled) return 0;
+
+	ProfileBlock* block = getProfileBlock(name);
+	if (!block) return 0;
+
+	return convertTotalDuration(static_cast<double>(block->totalCpuMicroseconds), 
+		format);
+}
+
+unsigned long long int Profiler::getNumContextSwitches(const std::string& name, 
+	bool voluntary) const
+{
+	if (!mEnabled) return 0;
+
+	ProfileBlock* block = getProfileBlock(name);
+	if (!block) return 0;
+
+	return voluntary ? block->totalVoluntarySwitches : 
+		block->totalInvoluntarySwitches;
+}
+
+double Profiler::getTimeSinceInit(TimeFormat format) const
+{
+	double timeSinceInit = 0;
+    const double timeMicroseconds = static_cast<double>(mClock.getTimeMicroseconds());
+	switch(format)
+	{
+		case SECONDS: timeSinceInit=timeMicroseconds*0.000001; break;
+		case MILLISECONDS: timeSinceInit=timeMicroseconds*0.001; break;
+		case MICROSECONDS: timeSinceInit=timeMicroseconds; break;
+		case PERCENT: timeSinceInit = 100; break;
+		default: break;
+	}
+	if (timeSinceInit < 0) timeSinceInit = 0;
+	return timeSinceInit;
+}
+
+std::string Profiler::getSummary(TimeFormat format) const
+{
+	if (!mEnabled) return "";
+
+	std::ostringstream oss;
+	std::string suffix = getSuffixString(format);
+
+	ProfileBlocks::const_iterator blocksBegin = mBlocks.begin();
+	ProfileBlocks::const_iterator blocksEnd = mBlocks.end();
+	ProfileBlocks::const_iterator iter = blocksBegin;
+	for (; iter != blocksEnd; ++iter)
+	{
+		if (iter != blocksBegin) oss << "\n";
+		oss << iter->first;
+		oss << ": ";
+		oss << getTotalDuration(iter->first, format);
+		oss << " ";
+		oss << suffix;
+
+		const ProfileBlock* block = iter->second;
+		if (block->numCpuSamples > 0)
+		{
+			// Split the block time into on-CPU and off-CPU time.
+			double total = static_cast<double>(block->totalMicroseconds);
+			double cpu = static_cast<double>(block->totalCpuMicroseconds);
+			if (cpu > total) cpu = total;
+			oss << " (on-CPU: " << convertTotalDuration(cpu, format) << " " 
+				<< suffix << ", off-CPU: " << convertTotalDuration(total - cpu, 
+				format) << " " << suffix << ", context switches: " 
+				<< block->totalVoluntarySwitches << " voluntary, " 
+				<< block->totalInvoluntarySwitches << " involuntary)";
+		}
+
+		// Print the time of each argument value.
+		const std::vector<BlockVariant>& variants = iter->second->variants;
+		for (size_t i = 0; i < variants.size(); ++i)
+		{
+			const BlockVariant& variant = variants[i];
+			if (0 == variant.numCalls) continue;
+			std::string variantName = iter->first;
+			if (i + 1 == variants.size())
+			{
+				substituteArg(variantName, iter->second->variantArgIndex, "<other>");
+			}
+			else
+			{
+				BlockArg args[ProfileBlock::MAX_ARGS];
+				args[iter->second->variantArgIndex] = variant.key;
+				variantName = formatBlockName(iter->first, args, 
+					iter->second->variantArgIndex + 1);
+			}
+			oss << "\n  " << variantName << ": " << convertTotalDuration(static_cast<double>(
+				variant.totalMicroseconds), format) << " " << suffix;
+		}
+	}
+
+	return oss.str();
+}
+
+size_t Profiler::getNumBlocks() const
+{
+	return mBlocks.size();
+}
+
+const std::string& Profiler::getBlockName(size_t i) const
+{
+	if (i>=mBlocks.size())
+	{
+		printError("Invalid block index");
+		static std::string empty="";
+		return empty;
+	}
+	ProfileBlocks::const_iterator iter=mBlocks.begin();
+	for (size_t j=0;j<i;++j) ++iter;
+	return iter->first;
+}
+
+std::string Profiler::getPlacementReport(TimeFormat format) const
+{
+	if (!mEnabled) return "";
+
+	std::ostringstream oss;
+	std::string suffix = getSuffixString(format);
+
+	ProfileBlocks::const_iterator iter = mBlocks.begin();
+	for (; iter != mBlocks.end(); ++iter)
+	{
+		const ProfileBlock* block = iter->second;
+		if (0 == block->numPlacementSamples) continue;
+
+		if (oss.tellp() > 0) oss << "\n";
+		double samples = static_cast<double>(block->numPlacementSamples);
+		oss << iter->first << ": " << block->numPlacementSamples << " updates, " 
+			<< block->numCpuMigrations << " migrated CPUs (" 
+			<< 100.0 * static_cast<double>(block->numCpuMigrations) / samples 
+			<< "%), " << block->numNodeMigrations << " migrated nodes (" 
+			<< 100.0 * static_cast<double>(block->numNodeMigrations) / samples 
+			<< "%)";
+		if (block->numSkewedSamples > 0)
+		{
+			oss << ", " << block->numSkewedSamples << " skewed";
+		}
+
+		oss << "\n  time by CPU:";
+		for (size_t i = 0; i < block->cpuMicroseconds.size(); ++i)
+		{
+			if (0 == block->cpuMicroseconds[i]) continue;
+			oss << " " << i << ": " << convertTotalDuration(static_cast<double>(
+				block->cpuMicroseconds[i]), format) << " " << suffix;
+		}
+
+		oss << "\n  time by node:";
+		for (size_t i = 0; i < block->nodeMicroseconds.size(); ++i)
+		{
+			if (0 == block->nodeMicroseconds[i]) continue;
+			oss << " " << i << ": " << convertTotalDuration(static_cast<double>(
+				block->nodeMicroseconds[i]), format) << " " << suffix;
+		}
+	}
+
+	return oss.str();
+}
+
+void Profiler::writeFoldedStacks(std::ostream& out, StackWeight weight, 
+	const std::string& rootFrame) const
+{
+	if (!mEnabled) return;
+
+	std::string stack = rootFrame;
+	for (size_t i = 0; i < mCallTreeRoot.children.size(); ++i)
+	{
+		writeFoldedStacks(out, mCallTreeRoot.children[i], stack, weight);
+	}
+}
+
+#ifdef USE_STD_THREADS
+LockStats* Profiler::getLockStats(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(mLocksMutex);
+	Locks::iterator iter = mLocks.find(name);
+	if (mLocks.end() != iter) return iter->second;
+
+	LockStats* stats = new LockStats();
+	stats->enabled = mEnabled;
+	mLocks[name] = stats;
+	return stats;
+}
+
+std::string Profiler::getLockReport(TimeFormat format) const
+{
+	std::ostringstream oss;
+	std::string suffix = getSuffixString(format);
+
+	std::lock_guard<std::mutex> lock(mLocksMutex);
+	for (Locks::const_iterator iter = mLocks.begin(); iter != mLocks.end(); ++iter)
+	{
+		const LockStats* stats = iter->second;
+		unsigned long long int numAcquisitions = 
+			stats->getTotal(&LockCounters::numAcquisitions) + 
+			stats->getTotal(&LockCounters::numSharedAcquisitions);
+		unsigned long long int numContended = 
+			stats->getTotal(&LockCounters::numContended);
+
+		if (iter != mLocks.begin()) oss << "\n";
+		oss << iter->first << ": " << numAcquisitions << " acquisitions, " 
+			<< (0 == numAcquisitions ? 0.0 : 100.0 * numContended / numAcquisitions) 
+			<< "% contended, wait: " 
+			<< convertTotalDuration(static_cast<double>(
+			stats->getTotal(&LockCounters::waitMicroseconds)), format) 
+			<< " " << suffix << ", hold: " 
+			<< convertTotalDuration(static_cast<double>(
+			stats->getTotal(&LockCounters::holdMicroseconds)), format) 
+			<< " " << suffix;
+
+		// Print the non-empty histogram buckets.
+		oss << "\n  wait histogram (us):";
+		for (size_t i = 0; i < LockStats::NUM_HISTOGRAM_BUCKETS; ++i)
+		{
+			unsigned long long int count = stats->contendedWaitHistogram[i];
+			if (0 == i) count += numAcquisitions - numContended;
+			if (0 == count) continue;
+			if (0 == i) oss << " <1";
+			else if (LockStats::NUM_HISTOGRAM_BUCKETS - 1 == i) oss << " >=" << (1ULL << (i - 1));
+			else oss << " " << (1ULL << (i - 1)) << "-" << (1ULL << i);
+			oss << ": " << count;
+		}
+	}
+
+	return oss.str();
+}
+
+void Profiler::beginParallelRegion(const std::string& name)
+{
+	if (!mEnabled) return;
+
+	beginBlock(name);
+
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	ParallelRegions::iterator iter = mRegions.find(name);
+	if (mRegions.end() == iter)
+	{
+		iter = mRegions.insert(ParallelRegions::value_type(name, 
+			new ParallelRegion())).first;
+	}
+	ParallelRegion* region = iter->second;
+	region->threads.clear();
+	for (size_t i = 0; i < region->numWorkers; ++i)
+	{
+		ParallelRegion::WorkerSlot& slot = region->workers[i];
+		slot.busyMicroseconds = 0;
+		slot.working = false;
+		slot.participated = false;
+	}
+	region->startMicroseconds = SteadyClock::getTimeMicroseconds();
+	region->active = true;
+}
+
+void Profiler::endParallelRegion(const std::string& name)
+{
+	if (!mEnabled) return;
+
+	unsigned long long int endTick = SteadyClock::getTimeMicroseconds();
+	unsigned long long int idle = 0;
+	bool measured = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mRegionsMutex);
+		ParallelRegions::iterator iter = mRegions.find(name);
+		if (mRegions.end() == iter || !iter->second->active)
+		{
+			printError("The parallel region named '" + name + 
+				"' has not begun.");
+			return;
+		}
+		ParallelRegion* region = iter->second;
+		region->active = false;
+
+		// Find the straggler and the mean busy time.  Work that hasn't 
+		// been ended counts until now.
+		size_t numThreads = region->threads.size();
+		unsigned long long int sumBusy = 0;
+		unsigned long long int maxBusy = 0;
+		size_t straggler = 0;
+		bool stragglerIsWorker = false;
+		for (size_t i = 0; i < numThreads; ++i)
+		{
+			ParallelRegion::ThreadWork& work = region->threads[i];
+			if (work.working)
+			{
+				work.busyMicroseconds += endTick - work.workStartMicroseconds;
+				work.working = false;
+			}
+			sumBusy += work.busyMicroseconds;
+			if (work.busyMicroseconds > maxBusy)
+			{
+				maxBusy = work.busyMicroseconds;
+				straggler = i;
+			}
+		}
+		for (size_t i = 0; i < region->numWorkers; ++i)
+		{
+			ParallelRegion::WorkerSlot& slot = region->workers[i];
+			if (!slot.participated.load(std::memory_order_relaxed)) continue;
+			if (slot.working.exchange(false, std::memory_order_relaxed))
+			{
+				slot.busyMicroseconds.fetch_add(endTick - 
+					slot.workStartMicroseconds.load(std::memory_order_relaxed), 
+					std::memory_order_relaxed);
+			}
+			unsigned long long int busy = 
+				slot.busyMicroseconds.load(std::memory_order_relaxed);
+			++numThreads;
+			sumBusy += busy;
+			if (busy > maxBusy)
+			{
+				maxBusy = busy;
+				straggler = i;
+				stragglerIsWorker = true;
+			}
+		}
+
+		if (numThreads > 0 && sumBusy > 0)
+		{
+			double imbalance = static_cast<double>(maxBusy) * 
+				static_cast<double>(numThreads) / static_cast<double>(sumBusy);
+
+			// Every other thread is idle while waiting for the straggler.  
+			// The rest of the region's time is dispatch overhead, which 
+			// is reported separately.
+			idle = maxBusy * numThreads - sumBusy;
+			unsigned long long int wall = endTick - region->startMicroseconds;
+			if (wall > maxBusy) region->totalDispatchMicroseconds += wall - maxBusy;
+
+			++region->currentCycleInstances;
+			region->currentCycleImbalance += imbalance;
+			++region->numInstances;
+			region->totalImbalance += imbalance;
+			if (imbalance > region->maxImbalance) region->maxImbalance = imbalance;
+			region->totalIdleMicroseconds += idle;
+			if (stragglerIsWorker) ++region->workerStragglers[straggler];
+			else ++region->stragglers[region->threads[straggler].id];
+			measured = true;
+		}
+	}
+
+	ProfileBlock* idleBlock = getOrCreateProfileBlock(name + ".idle");
+	if (idleBlock->enabled)
+	{
+		idleBlock->currentCycleTotalMicroseconds += idle;
+		idleBlock->totalMicroseconds += idle;
+		if (measured) ++idleBlock->numCalls;
+	}
+
+	endBlock(name);
+}
+
+void Profiler::beginRegionWork(const std::string& name)
+{
+	unsigned long long int startTick = SteadyClock::getTimeMicroseconds();
+
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	ParallelRegions::iterator iter = mRegions.find(name);
+	if (mRegions.end() == iter || !iter->second->active) return;
+
+	ParallelRegion::ThreadWork& work = getThreadWork(*iter->second);
+	work.workStartMicroseconds = startTick;
+	work.working = true;
+}
+
+void Profiler::endRegionWork(const std::string& name)
+{
+	unsigned long long int endTick = SteadyClock::getTimeMicroseconds();
+
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	ParallelRegions::iterator iter = mRegions.find(name);
+	if (mRegions.end() == iter || !iter->second->active) return;
+
+	ParallelRegion::ThreadWork& work = getThreadWork(*iter->second);
+	if (!work.working) return;
+	work.busyMicroseconds += endTick - work.workStartMicroseconds;
+	work.working = false;
+}
+
+ParallelRegion* Profiler::getRegionHandle(const std::string& name, 
+	size_t numWorkers)
+{
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	ParallelRegions::iterator iter = mRegions.find(name);
+	if (mRegions.end() == iter)
+	{
+		iter = mRegions.insert(ParallelRegions::value_type(name, 
+			new ParallelRegion())).first;
+	}
+
+	ParallelRegion* region = iter->second;
+	if (numWorkers > region->numWorkers)
+	{
+		if (region->active)
+		{
+			printError("Cannot add workers to the running parallel region '" + 
+				name + "'.");
+		}
+		else
+		{
+			delete [] region->workers;
+			region->workers = new ParallelRegion::WorkerSlot[numWorkers];
+			region->numWorkers = numWorkers;
+		}
+	}
+	return region;
+}
+
+void Profiler::beginRegionWork(ParallelRegion* region, size_t worker)
+{
+	unsigned long long int startTick = SteadyClock::getTimeMicroseconds();
+
+	if (!region->active.load(std::memory_order_relaxed)) return;
+	if (worker >= region->numWorkers)
+	{
+		printError("Invalid parallel region worker index.");
+		return;
+	}
+
+	ParallelRegion::WorkerSlot& slot = region->workers[worker];
+	slot.workStartMicroseconds.store(startTick, std::memory_order_relaxed);
+	slot.participated.store(true, std::memory_order_relaxed);
+	slot.working.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::endRegionWork(ParallelRegion* region, size_t worker)
+{
+	unsigned long long int endTick = SteadyClock::getTimeMicroseconds();
+
+	if (!region->active.load(std::memory_order_relaxed)) return;
+	if (worker >= region->numWorkers)
+	{
+		printError("Invalid parallel region worker index.");
+		return;
+	}
+
+	// The region may have ended this work already.
+	ParallelRegion::WorkerSlot& slot = region->workers[worker];
+	if (!slot.working.exchange(false, std::memory_order_relaxed)) return;
+	slot.busyMicroseconds.fetch_add(endTick - 
+		slot.workStartMicroseconds.load(std::memory_order_relaxed), 
+		std::memory_order_relaxed);
+}
+
+double Profiler::getAvgImbalance(const std::string& name) const
+{
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	ParallelRegions::const_iterator iter = mRegions.find(name);
+	if (mRegions.end() == iter) return 0;
+	return iter->second->avgCycleImbalance;
+}
+
+std::string Profiler::getRegionReport(TimeFormat format) const
+{
+	std::ostringstream oss;
+	std::string suffix = getSuffixString(format);
+
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	bool first = true;
+	ParallelRegions::const_iterator iter = mRegions.begin();
+	for (; iter != mRegions.end(); ++iter)
+	{
+		const ParallelRegion* region = iter->second;
+		if (0 == region->numInstances) continue;
+
+		if (!first) oss << "\n";
+		first = false;
+		oss << iter->first << ": " << region->numInstances << " instances, " 
+			<< "imbalance (max/mean): " << region->avgCycleImbalance << " avg, " 
+			<< region->maxImbalance << " worst, idle: " 
+			<< convertTotalDuration(static_cast<double>(
+			region->totalIdleMicroseconds), format) << " " << suffix 
+			<< ", dispatch: " << convertTotalDuration(static_cast<double>(
+			region->totalDispatchMicroseconds), format) << " " << suffix 
+			<< ", stragglers:";
+
+		std::map<std::thread::id, unsigned long long int>::const_iterator 
+			straggler = region->stragglers.begin();
+		for (; straggler != region->stragglers.end(); ++straggler)
+		{
+			oss << " thread " << straggler->first << " (" 
+				<< straggler->second << "x)";
+		}
+		std::map<size_t, unsigned long long int>::const_iterator 
+			workerStraggler = region->workerStragglers.begin();
+		for (; workerStraggler != region->workerStragglers.end(); ++workerStraggler)
+		{
+			oss << " worker " << workerStraggler->first << " (" 
+				<< workerStraggler->second << "x)";
+		}
+	}
+
+	return oss.str();
+}
+
+void Profiler::updateRegions()
+{
+	std::lock_guard<std::mutex> lock(mRegionsMutex);
+	for (ParallelRegions::iterator iter = mRegions.begin(); iter != mRegions.end(); ++iter)
+	{
+		ParallelRegion* region = iter->second;
+
+		// Cycles without any instances don't affect the average.
+		if (0 == region->currentCycleInstances) continue;
+		double imbalance = region->currentCycleImbalance / 
+			static_cast<double>(region->currentCycleInstances);
+
+		// As with blocks, the first measurement sets the average to 
+		// avoid ramping up from zero.
+		if (region->numInstances == region->currentCycleInstances)
+		{
+			region->avgCycleImbalance = imbalance;
+		}
+		else
+		{
+			region->avgCycleImbalance = mMovingAvgScalar * 
+				region->avgCycleImbalance + (1 - mMovingAvgScalar) * imbalance;
+		}
+
+		region->currentCycleInstances = 0;
+		region->currentCycleImbalance = 0;
+	}
+}
+
+ParallelRegion::ThreadWork& Profiler::getThreadWork(ParallelRegion& region)
+{
+	std::thread::id id = std::this_thread::get_id();
+	for (size_t i = 0; i < region.threads.size(); ++i)
+	{
+		if (region.threads[i].id == id) return region.threads[i];
+	}
+
+	ParallelRegion::ThreadWork work;
+	work.id = id;
+	work.busyMicroseconds = 0;
+	work.workStartMicroseconds = 0;
+	work.working = false;
+	region.threads.push_back(work);
+	return region.threads.back();
+}
+
+void Profiler::collectLockTimes()
+{
+	std::lock_guard<std::mutex> lock(mLocksMutex);
+	for (Locks::iterator iter = mLocks.begin(); iter != mLocks.end(); ++iter)
+	{
+		// Add what changed since the last cycle.  Hold times are only 
+		// recorded for exclusive acquisitions.
+		LockStats* stats = iter->second;
+		unsigned long long int numExclusive = 
+			stats->getTotal(&LockCounters::numAcquisitions);
+		unsigned long long int numAcquisitions = numExclusive + 
+			stats->getTotal(&LockCounters::numSharedAcquisitions);
+		if (0 == numAcquisitions) continue;
+		unsigned long long int totalWait = stats->getTotal(&LockCounters::waitMicroseconds);
+		unsigned long long int totalHold = stats->getTotal(&LockCounters::holdMicroseconds);
+
+		unsigned long long int numWaits = numAcquisitions - stats->collectedAcquisitions;
+		unsigned long long int numHolds = numExclusive - stats->collectedExclusiveAcquisitions;
+		unsigned long long int wait = totalWait - stats->collectedWaitMicroseconds;
+		unsigned long long int hold = totalHold - stats->collectedHoldMicroseconds;
+		stats->collectedAcquisitions = numAcquisitions;
+		stats->collectedExclusiveAcquisitions = numExclusive;
+		stats->collectedWaitMicroseconds = totalWait;
+		stats->collectedHoldMicroseconds = totalHold;
+
+		ProfileBlock* waitBlock = getOrCreateProfileBlock(iter->first + ".wait");
+		if (waitBlock->enabled)
+		{
+			waitBlock->currentCycleTotalMicroseconds += wait;
+			waitBlock->totalMicroseconds += wait;
+			waitBlock->numCalls += numWaits;
+		}
+
+		ProfileBlock* holdBlock = getOrCreateProfileBlock(iter->first + ".hold");
+		if (holdBlock->enabled)
+		{
+			holdBlock->currentCycleTotalMicroseconds += hold;
+			holdBlock->totalMicroseconds += hold;
+			holdBlock->numCalls += numHolds;
+		}
+	}
+}
+#endif
+
+void Profiler::printError(const std::string& msg) const
+{
+	std::cout << "[QuickProf error] " << msg << std::endl;
+}
+
+ProfileBlock* Profiler::getProfileBlock(const std::string& name) const
+{
+	ProfileBlocks::const_iterator iter = mBlocks.find(name);
+	if (mBlocks.end() == iter)
+	{
+		// The named block does not exist.  Print an error.
+		printError("The profile block named '" + name + 
+			"' does not exist.");
+		return NULL;
+	}
+	else return iter->second;
+}
+
+void Profiler::writeFoldedStacks(std::ostream& out, const CallTreeNode* node, 
+	std::string& stack, StackWeight weight) const
+{
+	size_t stackLength = stack.size();
+	if (!stack.empty()) stack += ';';
+	for (size_t i = 0; i < node->name->size(); ++i)
+	{
+		// Semicolons separate frames, so they can't appear in names.
+		char c = (*node->name)[i];
+		stack += (';' == c || '\n' == c) ? '_' : c;
+	}
+
+	unsigned long long int value = 0;
+	switch(weight)
+	{
+		case SELF_TIME: value = node->totalMicroseconds - node->childMicroseconds; break;
+		case WALL_TIME: value = node->totalMicroseconds; break;
+		case CALL_COUNT: value = node->numCalls; break;
+		default: break;
+	}
+	if (value > 0) out << stack << " " << value << "\n";
+
+	for (size_t i = 0; i < node->children.size(); ++i)
+	{
+		writeFoldedStacks(out, node->children[i], stack, weight);
+	}
+
+	stack.resize(stackLength);
+}
+
+double Profiler::convertTotalDuration(double microseconds, TimeFormat format) const
+{
+	double result = 0;
+
+	switch(format)
+	{
+		case SECONDS: result=microseconds*0.000001; break;
+		case MILLISECONDS: result=microseconds*0.001; break;
+		case MICROSECONDS: result=microseconds; break;
+		case PERCENT:
+		{
+			double microsecondsSinceInit=getTimeSinceInit(MICROSECONDS);
+			if (0==microsecondsSinceInit) result=0;
+			else result=100.0*microseconds/microsecondsSinceInit;
+			break;
+		}
+		default: break;
+	}
+
+	return result;
+}
+
+std::string Profiler::formatBlockName(const std::string& name, 
+	const BlockArg* args, size_t numArgs) const
+{
+	std::string result = name;
+	for (size_t i = 0; i < numArgs; ++i)
+	{
+		if (BlockArg::NONE == args[i].type) continue;
+
+		std::ostringstream oss;
+		if (BlockArg::STRING == args[i].type && 
+			static_cast<size_t>(args[i].value) < mInternedStrings.size())
+		{
+			oss << mInternedStrings[static_cast<size_t>(args[i].value)];
+		}
+		else oss << args[i].value;
+		substituteArg(result, i, oss.str());
+	}
+	return result;
+}
+
+void Profiler::substituteArg(std::string& name, size_t index, 
+	const std::string& value)
+{
+	// Replace the argument's placeholder, or append it.
+	std::ostringstream placeholder;
+	placeholder << "{" << index << "}";
+	std::string::size_type pos = name.find(placeholder.str());
+	if (std::string::npos != pos) name.replace(pos, placeholder.str().size(), value);
+	else name += ":" + value;
+}
+
+ProfileBlock* Profiler::getOrCreateProfileBlock(const std::string& name)
+{
+	ProfileBlocks::iterator iter = mBlocks.find(name);
+	if (mBlocks.end() != iter) return iter->second;
+
+	// The named block does not exist.  Create a new ProfileBlock.
+	ProfileBlock* block = newProfileBlock(name);
+	iter = mBlocks.insert(ProfileBlocks::value_type(name, block)).first;
+	block->name = &iter->first;
+	block->enabled = isBlockEnabled(name);
+	return block;
+}
+
+ProfileBlock* Profiler::newProfileBlock(const std::string& name)
+{
+	ProfileBlocks::iterator iter = mRetiredBlocks.find(name);
+	if (mRetiredBlocks.end() == iter) return new ProfileBlock();
+
+	ProfileBlock* block = iter->second;
+	mRetiredBlocks.erase(iter);
+	block->retired = false;
+	return block;
+}
+
+void Profiler::restoreProfileBlock(ProfileBlock* block)
+{
+	// Copy the name, which is owned by mRetiredBlocks.
+	std::string name = *block->name;
+	mRetiredBlocks.erase(name);
+	block->retired = false;
+	block->name = &mBlocks.insert(ProfileBlocks::value_type(name, block)).first->first;
+}
+
+bool Profiler::isBlockEnabled(const std::string& name) const
+{
+	if (!mEnabled) return false;
+
+	// The environment rules come last.
+	const std::vector<BlockFilter>* filterLists[2] = {&mBlockFilters, &mEnvBlockFilters};
+	bool enabled = true;
+	bool firstRule = true;
+	for (size_t list = 0; list < 2; ++list)
+	{
+		const std::vector<BlockFilter>& filters = *filterLists[list];
+		for (size_t i = 0; i < filters.size(); ++i)
+		{
+			// If the first rule enables blocks, only enabled blocks are timed.
+			if (firstRule) enabled = !filters[i].enable;
+			firstRule = false;
+
+			if (matchesPattern(filters[i].pattern, name)) enabled = filters[i].enable;
+		}
+	}
+	return enabled;
+}
+
+void Profiler::applyBlockFilters()
+{
+	for (ProfileBlocks::iterator iter = mBlocks.begin(); iter != mBlocks.end(); ++iter)
+	{
+		iter->second->enabled = isBlockEnabled(iter->first);
+	}
+
+	// Retired blocks are restored when their handles are used.
+	for (ProfileBlocks::iterator iter = mRetiredBlocks.begin(); 
+		iter != mRetiredBlocks.end(); ++iter)
+	{
+		iter->second->enabled = isBlockEnabled(iter->first);
+	}
+}
+
+void Profiler::checkBlockFilterFile()
+{
+	std::ifstream file(mBlockFilterFilename.c_str());
+	if (!file.is_open()) return;
+
+	std::string contents((std::istreambuf_iterator<char>(file)), 
+		std::istreambuf_iterator<char>());
+	if (contents == mBlockFilterFileContents) return;
+
+	mBlockFilterFileContents = contents;
+	setBlockFilters(contents);
+}
+
+bool Profiler::matchesPattern(const std::string& pattern, 
+	const std::string& name)
+{
+	// Match greedily, backtracking to the most recent '*' on a mismatch.
+	size_t p = 0;
+	size_t n = 0;
+	size_t starPattern = std::string::npos;
+	size_t starName = 0;
+	while (n < name.size())
+	{
+		if (p < pattern.size() && ('?' == pattern[p] || pattern[p] == name[n]))
+		{
+			++p;
+			++n;
+		}
+		else if (p < pattern.size() && '*' == pattern[p])
+		{
+			starPattern = p++;
+			starName = n;
+		}
+		else if (std::string::npos != starPattern)
+		{
+			p = starPattern + 1;
+			n = ++starName;
+		}
+		else return false;
+	}
+	while (p < pattern.size() && '*' == pattern[p]) ++p;
+	return p == pattern.size();
+}
+
+std::string Profiler::getSuffixString(TimeFormat format) const
+{
+	std::string suffix;
+	switch(format)
+	{
+		case SECONDS: suffix="s"; break;
+		case MILLISECONDS: suffix="ms"; break;
+		case MICROSECONDS: suffix="us"; break;
+		case PERCENT: suffix="%"; break;
+		default: break;
+	}
+	return suffix;
+}
+
+/**
+Prevents the compiler from optimizing away the computation of a value, 
+e.g. in a benchmarked function whose result is otherwise unused.
+
+@param value The value to keep.
+*/
+template <class T>
+inline void doNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	// The pointer itself must be volatile for the store to be kept.
+	static const void* volatile sink;
+	sink = &value;
+	#ifdef _MSC_VER
+		_ReadWriteBarrier();
+	#endif
+#endif
+}
+
+/**
+Forces the compiler to assume that all memory may have been read and 
+written, so memory loads in a benchmarked function are not hoisted out 
+of the benchmark loop or reused from an earlier iteration.
+*/
+inline void clobberMemory()
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : : "memory");
+#elif defined(_MSC_VER)
+	_ReadWriteBarrier();
+#endif
+}
+
+/// The results of a benchmark run (see Benchmark).  Times are per 
+/// iteration of the benchmarked function.
+struct BenchmarkResult
+{
+	BenchmarkResult() :
+		name(),
+		iterationsPerSample(0),
+		numSamples(0),
+		medianMicroseconds(0),
+		madMicroseconds(0),
+		meanMicroseconds(0),
+		minMicroseconds(0),
+		maxMicroseconds(0),
+		relativeConfidenceInterval(0),
+		numLowOutliers(0),
+		numHighOutliers(0),
+		converged(false)
+	{
+		// do nothing
+	}
+
+	/**
+	Returns a one-line summary of the results.
+
+	@return The summary as a string.
+	*/
+	std::string toString() const
+	{
+		std::ostringstream oss;
+		oss << name << ": median " << medianMicroseconds << " us, MAD " 
+			<< madMicroseconds << " us, mean " << meanMicroseconds 
+			<< " us, min " << minMicroseconds << " us, max " << maxMicroseconds 
+			<< " us, 95% CI +/-" << 100.0 * relativeConfidenceInterval << "%, " 
+			<< numSamples << " samples x " << iterationsPerSample 
+			<< " iterations, outliers: " << numLowOutliers << " low, " 
+			<< numHighOutliers << " high";
+		if (!converged) oss << " (did not converge)";
+		return oss.str();
+	}
+
+	/// The benchmark name.
+	std::string name;
+
+	/// The number of iterations timed together in each sample.
+	size_t iterationsPerSample;
+
+	/// The number of samples taken.
+	size_t numSamples;
+
+	/// The median time (in us) per iteration, and the median absolute 
+	/// deviation of the samples from it.
+	double medianMicroseconds;
+	double madMicroseconds;
+
+	/// The mean, minimum and maximum time (in us) per iteration.
+	double meanMicroseconds;
+	double minMicroseconds;
+	double maxMicroseconds;
+
+	/// The half-width of the 95% confidence interval of the median, 
+	/// relative to the median.
+	double relativeConfidenceInterval;
+
+	/// The number of samples more than 3 robust standard deviations 
+	/// (1.4826 * MAD) below or above the median.
+	size_t numLowOutliers;
+	size_t numHighOutliers;
+
+	/// Whether the target precision was reached before the sample or 
+	/// time limit.  This is also false, with no samples, if a batch of 
+	/// the maximum size was still too fast to time, e.g. because the 
+	/// function was optimized away.
+	bool converged;
+};
+
+/// Runs isolated micro-benchmarks using the profiler's clock.
+/// 
+/// The benchmarked function is warmed up, then called in batches large 
+/// enough that each sample is well above the clock resolution, until 
+/// the confidence interval of the median is narrow enough.  Each 
+/// sample's time is also added to a profiler block with the benchmark's 
+/// name, so benchmarks show up in getSummary and the output file like 
+/// any other block.  Memory is clobbered between iterations (see 
+/// clobberMemory), but work that only depends on constants or local 
+/// variables of the function can still be hoisted out of the loop; 
+/// pass such inputs through doNotOptimize.  For example: 
+/// quickprof::Benchmark benchmark;
+/// std::cout << benchmark.run("sort", sortFunctor).toString() << std::endl;
+class Benchmark
+{
+public:
+	/**
+	@param profiler The profiler that receives the benchmark times.
+	*/
+	explicit Benchmark(Profiler& profiler=Profiler::instance()) :
+		mProfiler(profiler),
+		mClock(),
+		mWarmupMicroseconds(100000),
+		mMinSampleMicroseconds(0),
+		mTargetPrecision(0.01),
+		mMinSamples(10),
+		mMaxSamples(1000),
+		mMaxMicroseconds(5000000),
+		mPinnedCpu(-1),
+		mRecordCycles(false)
+	{
+		// do nothing
+	}
+
+	/**
+	Sets how long the function is run before measuring.  The default is 
+	0.1 seconds.
+
+	@param seconds The warm-up time.
+	*/
+	void setWarmupTime(double seconds)
+	{
+		mWarmupMicroseconds = toMicroseconds(seconds);
+	}
+
+	/**
+	Sets the minimum duration of each sample.  The default (zero) uses 
+	1000 times the measured clock resolution, and at least 1 ms.
+
+	@param seconds The minimum sample time.
+	*/
+	void setMinSampleTime(double seconds)
+	{
+		mMinSampleMicroseconds = toMicroseconds(seconds);
+	}
+
+	/**
+	Sets the target half-width of the 95% confidence interval of the 
+	median, relative to the median.  The default is 0.01 (1%).
+
+	@param relativePrecision The target precision.
+	*/
+	void setTargetPrecision(double relativePrecision)
+	{
+		mTargetPrecision = relativePrecision;
+	}
+
+	/**
+	Sets the limits on the number of samples and the total measuring 
+	time.  The defaults are 10 to 1000 samples and 5 seconds.
+
+	@param minSamples The minimum number of samples (at least 2).
+	@param maxSamples The maximum number of samples.
+	@param maxSeconds The maximum measuring time (excluding warm-up).
+	*/
+	void setLimits(size_t minSamples, size_t maxSamples, double maxSeconds)
+	{
+		mMinSamples = minSamples < 2 ? 2 : minSamples;
+		mMaxSamples = maxSamples < mMinSamples ? mMinSamples : maxSamples;
+		mMaxMicroseconds = toMicroseconds(maxSeconds);
+	}
+
+	/**
+	Pins the benchmarking thread to a CPU while running, to avoid 
+	migrations.  The thread's previous affinity is restored afterwards.  
+	If the CPU doesn't exist or can't be represented in the platform's 
+	affinity mask, an error is printed and the thread is not pinned.
+
+	@param cpu The CPU index, or -1 to not pin the thread (the default).
+	*/
+	void setCpuPinning(int cpu)
+	{
+		mPinnedCpu = cpu;
+	}
+
+	/**
+	Makes each sample a profiling cycle (see Profiler::endCycle), so the 
+	output file gets one line per sample.  This is off by default.
+
+	@param enabled Whether each sample ends a profiling cycle.
+	*/
+	void setRecordCycles(bool enabled)
+	{
+		mRecordCycles = enabled;
+	}
+
+	/**
+	Benchmarks a function.
+
+	@param name     The benchmark name, also used as the profiler block 
+	                name.
+	@param function A function or functor taking no arguments.  Its 
+	                return value, if any, is kept from being optimized 
+	                away.
+	@return         The benchmark results.
+	*/
+	template <class Function>
+	BenchmarkResult run(const std::string& name, Function function)
+	{
+		BenchmarkResult result;
+		result.name = name;
+		ProfileBlock* block = mProfiler.getBlockHandle(name);
+		bool pinned = pinThread();
+
+		// Warm up caches, branch predictors and CPU frequency.
+		unsigned long long int start = mClock.getTimeMicroseconds();
+		do
+		{
+			call(function);
+		}
+		while (mClock.getTimeMicroseconds() - start < mWarmupMicroseconds);
+
+		// Grow the batch size until a sample is long enough.
+		unsigned long long int minSampleTime = mMinSampleMicroseconds;
+		if (0 == minSampleTime)
+		{
+			minSampleTime = 1000 * getClockResolution();
+			if (minSampleTime < 1000) minSampleTime = 1000;
+		}
+		const size_t maxIterations = 1000000000;
+		size_t iterations = 1;
+		while (true)
+		{
+			unsigned long long int elapsed = timeBatch(function, iterations);
+			if (elapsed >= minSampleTime) break;
+			if (iterations >= maxIterations)
+			{
+				std::cout << "[QuickProf error] The benchmark " << name 
+					<< " is too fast to reach the minimum sample time; it may " 
+					"have been optimized away." << std::endl;
+				result.iterationsPerSample = iterations;
+				if (pinned) unpinThread();
+				return result;
+			}
+
+			// Aim a little past the target, growing 2-10x per step.
+			double scale = elapsed > 0 ? 1.2 * static_cast<double>(minSampleTime) / 
+				static_cast<double>(elapsed) : 10.0;
+			if (scale < 2) scale = 2;
+			if (scale > 10) scale = 10;
+			double next = static_cast<double>(iterations) * scale;
+			iterations = next < static_cast<double>(maxIterations) ? 
+				static_cast<size_t>(next) : maxIterations;
+		}
+		result.iterationsPerSample = iterations;
+
+		// Take samples until the median is precise enough.
+		std::vector<double> samples;
+		samples.reserve(mMaxSamples);
+		start = mClock.getTimeMicroseconds();
+		while (samples.size() < mMaxSamples)
+		{
+			unsigned long long int elapsed = timeBatch(function, iterations);
+			samples.push_back(static_cast<double>(elapsed) / 
+				static_cast<double>(iterations));
+			mProfiler.addBlockTime(block, elapsed);
+			if (mRecordCycles) mProfiler.endCycle();
+
+			if (samples.size() < mMinSamples) continue;
+			computeStatistics(samples, result);
+			if (result.relativeConfidenceInterval <= mTargetPrecision)
+			{
+				result.converged = true;
+				break;
+			}
+			if (mClock.getTimeMicroseconds() - start >= mMaxMicroseconds) break;
+		}
+		computeStatistics(samples, result);
+
+		if (pinned) unpinThread();
+		return result;
+	}
+
+private:
+	Benchmark(const Benchmark&);
+	Benchmark& operator=(const Benchmark&);
+
+	/// Keeps the return value of the benchmarked function, if any, via 
+	/// the comma operator: "ResultSink(), f()" calls this overload when 
+	/// f returns a value, and the built-in comma operator when it 
+	/// returns void.
+	struct ResultSink
+	{
+		template <class T>
+		friend void operator,(ResultSink, const T& value)
+		{
+			doNotOptimize(value);
+		}
+	};
+
+	template <class Function>
+	static void call(Function& function)
+	{
+		ResultSink(), function();
+	}
+
+	template <class Function>
+	unsigned long long int timeBatch(Function& function, size_t iterations)
+	{
+		unsigned long long int start = mClock.getTimeMicroseconds();
+		for (size_t i = 0; i < iterations; ++i)
+		{
+			call(function);
+			clobberMemory();
+		}
+		return mClock.getTimeMicroseconds() - start;
+	}
+
+	static unsigned long long int toMicroseconds(double seconds)
+	{
+		return seconds > 0 ? static_cast<unsigned long long int>(seconds * 1000000) : 0;
+	}
+
+	/// Measures the smallest nonzero clock increment (in us).
+	unsigned long long int getClockResolution() const
+	{
+		unsigned long long int resolution = 0;
+		for (int i = 0; i < 5; ++i)
+		{
+			unsigned long long int t0 = mClock.getTimeMicroseconds();
+			unsigned long long int t1 = t0;
+			while (t1 == t0) t1 = mClock.getTimeMicroseconds();
+			if (0 == resolution || t1 - t0 < resolution) resolution = t1 - t0;
+		}
+		return resolution;
 	}
 
-	if (!outputFilename.empty()) mOutputFile.open(outputFilename.c_str());
-
-	if (printPeriod < 1)
+	static double getMedian(std::vector<double>& values)
 	{
-		printError("Print period must be >= 1. Using 1.");
-		mPrintPeriod = 1;
+		std::sort(values.begin(), values.end());
+		size_t n = values.size();
+		return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
 	}
-	else mPrintPeriod = printPeriod;
-	mPrintFormat = printFormat;
 
-	mClock.reset();
+	static void computeStatistics(const std::vector<double>& samples, 
+		BenchmarkResult& result)
+	{
+		result.numSamples = samples.size();
+		if (samples.empty()) return;
 
-	// Set the start time for the first cycle.
-	mCurrentCycleStartMicroseconds = mClock.getTimeMicroseconds();
-}
+		std::vector<double> sorted(samples);
+		result.medianMicroseconds = getMedian(sorted);
+		result.minMicroseconds = sorted.front();
+		result.maxMicroseconds = sorted.back();
 
-void Profiler::beginBlock(const std::string& name)
-{
-	if (!mEnabled) return;
+		double sum = 0;
+		std::vector<double> deviations(samples.size());
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			sum += samples[i];
+			deviations[i] = std::fabs(samples[i] - result.medianMicroseconds);
+		}
+		result.meanMicroseconds = sum / static_cast<double>(samples.size());
+		result.madMicroseconds = getMedian(deviations);
 
-	if (name.empty())
-	{
-		printError("Cannot allow unnamed profile blocks.");
-		return;
-	}
+		// Use the MAD as a robust estimate of the standard deviation.  
+		// The standard error of the median is about 1.2533 times that 
+		// of the mean.
+		double sigma = 1.4826 * result.madMicroseconds;
+		double halfWidth = 1.96 * 1.2533 * sigma / 
+			std::sqrt(static_cast<double>(samples.size()));
+		result.relativeConfidenceInterval = result.medianMicroseconds > 0 ? 
+			halfWidth / result.medianMicroseconds : 0;
 
-	ProfileBlock* block = NULL;
+		result.numLowOutliers = 0;
+		result.numHighOutliers = 0;
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			if (samples[i] < result.medianMicroseconds - 3 * sigma) ++result.numLowOutliers;
+			else if (samples[i] > result.medianMicroseconds + 3 * sigma) ++result.numHighOutliers;
+		}
+	}
 
-	ProfileBlocks::iterator iter = mBlocks.find(name);
-	if (mBlocks.end() == iter)
+	bool pinThread()
 	{
-		// The named block does not exist.  Create a new ProfileBlock.
-		block = new ProfileBlock();
-		mBlocks[name] = block;
+		if (mPinnedCpu < 0) return false;
+#if defined(USE_WINDOWS_TIMERS)
+		// The affinity mask has one bit per CPU in the processor group.
+		if (mPinnedCpu < static_cast<int>(sizeof(DWORD_PTR) * 8))
+		{
+			mPreviousAffinity = SetThreadAffinityMask(GetCurrentThread(), 
+				static_cast<DWORD_PTR>(1) << mPinnedCpu);
+			if (0 != mPreviousAffinity) return true;
+		}
+#elif defined(__linux__)
+		if (mPinnedCpu < CPU_SETSIZE && 
+			0 == sched_getaffinity(0, sizeof(mPreviousAffinity), &mPreviousAffinity))
+		{
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(mPinnedCpu, &cpus);
+			if (0 == sched_setaffinity(0, sizeof(cpus), &cpus)) return true;
+		}
+#endif
+		std::cout << "[QuickProf error] Cannot pin the benchmark thread to CPU " 
+			<< mPinnedCpu << "." << std::endl;
+		return false;
 	}
-	else block = iter->second;
 
-	// We do this at the end to get more accurate results.
-	block->currentBlockStartMicroseconds = mClock.getTimeMicroseconds();
-}
+	void unpinThread()
+	{
+#if defined(USE_WINDOWS_TIMERS)
+		SetThreadAffinityMask(GetCurrentThread(), mPreviousAffinity);
+#elif defined(__linux__)
+		sched_setaffinity(0, sizeof(mPreviousAffinity), &mPreviousAffinity);
+#endif
+	}
 
-void Profiler::endBlock(const std::string& name)
-{
-	if (!mEnabled) return;
+	/// The profiler that receives the benchmark times.
+	Profiler& mProfiler;
 
-	// We do this at the beginning to get more accurate results.
-	unsigned long long int endTick = mClock.getTimeMicroseconds();
+	/// The clock used to time the samples.
+	Clock mClock;
 
-	ProfileBlock* block = getProfileBlock(name);
-	if (!block) return;
+	/// The settings, with times in us.
+	unsigned long long int mWarmupMicroseconds;
+	unsigned long long int mMinSampleMicroseconds;
+	double mTargetPrecision;
+	size_t mMinSamples;
+	size_t mMaxSamples;
+	unsigned long long int mMaxMicroseconds;
+	int mPinnedCpu;
+	bool mRecordCycles;
 
-	unsigned long long int blockDuration = endTick - block->currentBlockStartMicroseconds;
-	block->currentCycleTotalMicroseconds += blockDuration;
-	block->totalMicroseconds += blockDuration;
-}
+	/// The thread's CPU affinity before pinning.
+#if defined(USE_WINDOWS_TIMERS)
+	DWORD_PTR mPreviousAffinity;
+#elif defined(__linux__)
+	cpu_set_t mPreviousAffinity;
+#endif
+};
 
-void Profiler::endCycle()
+#ifdef USE_STD_THREADS
+/// Wraps an existing lockable object (e.g. a std::mutex) to record the 
+/// time spent waiting to acquire it and the time it is held.  The times 
+/// are added to the named lock's statistics (see 
+/// Profiler::getLockStats).  This can be used with std::lock_guard and 
+/// std::unique_lock.  When the profiler is disabled, locking costs one 
+/// extra branch.
+template <class MutexType>
+class MutexRef
 {
-	if (!mEnabled) return;
-
-	// Update the average total cycle time.
-	// On the first cycle we set the average cycle time equal to the 
-	// measured cycle time.  This avoids having to ramp up the average 
-	// from zero initially.
-	unsigned long long int currentCycleDurationMicroseconds = 
-		mClock.getTimeMicroseconds() - mCurrentCycleStartMicroseconds;
-	if (mFirstCycle)
-	{
-		mAvgCycleDurationMicroseconds = 
-			static_cast<double>(currentCycleDurationMicroseconds);
-	}
-	else
+public:
+	/**
+	@param mutex    The mutex to wrap.  It must outlive this object.
+	@param name     The name of the lock.  Several wrappers can share 
+	                a name, e.g. for a set of striped locks.
+	@param profiler The profiler that records the lock times.
+	*/
+	MutexRef(MutexType& mutex, const std::string& name, 
+		Profiler& profiler=Profiler::instance()) :
+		mMutex(mutex),
+		mStats(profiler.getLockStats(name)),
+		mCounters(mStats->getCounters()),
+		mHoldStartMicroseconds(0),
+		mTimed(false)
 	{
-		mAvgCycleDurationMicroseconds = mMovingAvgScalar * 
-			mAvgCycleDurationMicroseconds + (1 - mMovingAvgScalar) 
-			* static_cast<double>(currentCycleDurationMicroseconds);
+		// do nothing
 	}
 
-	// Update the average cycle time for each block.
-	ProfileBlocks::iterator blocksBegin = mBlocks.begin();
-	ProfileBlocks::iterator blocksEnd = mBlocks.end();
-	ProfileBlocks::iterator iter = blocksBegin;
-	for (; iter != blocksEnd; ++iter)
+	void lock()
 	{
-		ProfileBlock* block = iter->second;
+		if (!mStats->enabled.load(std::memory_order_relaxed))
+		{
+			mMutex.lock();
+			return;
+		}
 
-		// On the first cycle we set the average cycle time equal to the 
-		// measured cycle time.  This avoids having to ramp up the average 
-		// from zero initially.
-		if (mFirstCycle)
+		// Only read the clock a second time if we have to wait.
+		if (mMutex.try_lock())
 		{
-			block->avgCycleTotalMicroseconds = 
-				static_cast<double>(block->currentCycleTotalMicroseconds);
+			mHoldStartMicroseconds = SteadyClock::getTimeMicroseconds();
+			mStats->recordAcquisition(*mCounters, 0, false);
 		}
 		else
 		{
-			block->avgCycleTotalMicroseconds = mMovingAvgScalar * 
-				block->avgCycleTotalMicroseconds + (1 - mMovingAvgScalar) * 
-				static_cast<double>(block->currentCycleTotalMicroseconds);
+			unsigned long long int waitStart = SteadyClock::getTimeMicroseconds();
+			mMutex.lock();
+			mHoldStartMicroseconds = SteadyClock::getTimeMicroseconds();
+			mStats->recordAcquisition(*mCounters, mHoldStartMicroseconds - waitStart, true);
 		}
-
-		block->currentCycleTotalMicroseconds = 0;
+		mTimed = true;
 	}
 
-	if (mFirstCycle) mFirstCycle = false;
-
-	// If enough cycles have passed, print data to the output file.
-	if (mOutputFile.is_open() && mCycleCounter % mPrintPeriod == 0)
+	bool try_lock()
 	{
-		mCycleCounter = 0;
-
-		if (mFirstFileOutput)
+		if (!mMutex.try_lock()) return false;
+		if (mStats->enabled.load(std::memory_order_relaxed))
 		{
-			// On the first iteration, print a header line that shows the 
-			// names of each data column (i.e. profiling block names).
-			mOutputFile << "# t(s)";
-
-			std::string suffix = getSuffixString(mPrintFormat);
-			for (iter = blocksBegin; iter != blocksEnd; ++iter)
-			{
-				mOutputFile  << " " << (*iter).first << "(" << suffix << ")";
-			}
-
-			mOutputFile << std::endl;
-			mFirstFileOutput = false;
+			mHoldStartMicroseconds = SteadyClock::getTimeMicroseconds();
+			mStats->recordAcquisition(*mCounters, 0, false);
+			mTimed = true;
 		}
+		return true;
+	}
 
-		mOutputFile << getTimeSinceInit(SECONDS);
-
-		// Print the cycle time for each block.
-		for (iter = blocksBegin; iter != blocksEnd; ++iter)
+	void unlock()
+	{
+		if (!mTimed)
 		{
-			mOutputFile << " " << getAvgDuration((*iter).first, mPrintFormat);
+			mMutex.unlock();
+			return;
 		}
 
-		mOutputFile << std::endl;
+		// Read these while we still hold the lock.
+		mTimed = false;
+		unsigned long long int holdTime = 
+			SteadyClock::getTimeMicroseconds() - mHoldStartMicroseconds;
+		mMutex.unlock();
+		mStats->recordHold(*mCounters, holdTime);
 	}
 
-	++mCycleCounter;
-	mCurrentCycleStartMicroseconds = mClock.getTimeMicroseconds();
-}
-
-double Profiler::getAvgDuration(const std::string& name, TimeFormat format) const
-{
-	if (!mEnabled) return 0;
-
-	ProfileBlock* block = getProfileBlock(name);
-	if (!block) return 0;
-
-	double result=0;
-	switch(format)
+	/// Returns the wrapped mutex.
+	MutexType& native()
 	{
-		case SECONDS: result=block->avgCycleTotalMicroseconds*0.000001; break;
-		case MILLISECONDS: result=block->avgCycleTotalMicroseconds*0.001; break;
-		case MICROSECONDS: result=block->avgCycleTotalMicroseconds; break;
-		case PERCENT:
-		{
-			if (0==mAvgCycleDurationMicroseconds) result=0;
-			else result=100.0*block->avgCycleTotalMicroseconds/mAvgCycleDurationMicroseconds;
-			break;
-		}
-		default: break;
+		return mMutex;
 	}
-	return result;
-}
 
-double Profiler::getTotalDuration(const std::string& name, TimeFormat format) const
-{
-	if (!mEnabled) return 0;
+private:
+	MutexRef(const MutexRef&);
+	MutexRef& operator=(const MutexRef&);
 
-	ProfileBlock* block = getProfileBlock(name);
-	if (!block) return 0;
+	MutexType& mMutex;
+	LockStats* mStats;
 
-	double blockTotalMicroseconds = static_cast<double>(block->totalMicroseconds);
-	double result = 0;
+	/// This wrapper's counter group in mStats.
+	LockCounters* mCounters;
 
-	switch(format)
-	{
-		case SECONDS: result=blockTotalMicroseconds*0.000001; break;
-		case MILLISECONDS: result=blockTotalMicroseconds*0.001; break;
-		case MICROSECONDS: result=blockTotalMicroseconds; break;
-		case PERCENT:
-		{
-			double microsecondsSinceInit=getTimeSinceInit(MICROSECONDS);
-			if (0==microsecondsSinceInit) result=0;
-			else result=100.0*blockTotalMicroseconds/microsecondsSinceInit;
-			break;
-		}
-		default: break;
-	}
+	/// The time (in us) the current holder acquired the lock.
+	unsigned long long int mHoldStartMicroseconds;
 
-	return result;
-}
+	/// Whether the current holder's acquisition is being timed.
+	bool mTimed;
+};
 
-double Profiler::getTimeSinceInit(TimeFormat format) const
+/// A drop-in replacement for std::mutex that records lock wait and hold 
+/// times (see MutexRef).
+class Mutex
 {
-	double timeSinceInit = 0;
-    const double timeMicroseconds = static_cast<double>(mClock.getTimeMicroseconds());
-	switch(format)
+public:
+	/**
+	@param name     The name of the lock.
+	@param profiler The profiler that records the lock times.
+	*/
+	explicit Mutex(const std::string& name, 
+		Profiler& profiler=Profiler::instance()) :
+		mMutex(),
+		mRef(mMutex, name, profiler)
 	{
-		case SECONDS: timeSinceInit=timeMicroseconds*0.000001; break;
-		case MILLISECONDS: timeSinceInit=timeMicroseconds*0.001; break;
-		case MICROSECONDS: timeSinceInit=timeMicroseconds; break;
-		case PERCENT: timeSinceInit = 100; break;
-		default: break;
+		// do nothing
 	}
-	if (timeSinceInit < 0) timeSinceInit = 0;
-	return timeSinceInit;
-}
 
-std::string Profiler::getSummary(TimeFormat format) const
-{
-	if (!mEnabled) return "";
+	void lock()
+	{
+		mRef.lock();
+	}
 
-	std::ostringstream oss;
-	std::string suffix = getSuffixString(format);
+	bool try_lock()
+	{
+		return mRef.try_lock();
+	}
 
-	ProfileBlocks::const_iterator blocksBegin = mBlocks.begin();
-	ProfileBlocks::const_iterator blocksEnd = mBlocks.end();
-	ProfileBlocks::const_iterator iter = blocksBegin;
-	for (; iter != blocksEnd; ++iter)
+	void unlock()
 	{
-		if (iter != blocksBegin) oss << "\n";
-		oss << iter->first;
-		oss << ": ";
-		oss << getTotalDuration(iter->first, format);
-		oss << " ";
-		oss << suffix;
+		mRef.unlock();
 	}
 
-	return oss.str();
-}
+private:
+	std::mutex mMutex;
+	MutexRef<std::mutex> mRef;
+};
 
-size_t Profiler::getNumBlocks() const
+#ifdef USE_STD_SHARED_MUTEX
+/// A drop-in replacement for std::shared_mutex that records lock wait 
+/// and hold times (see MutexRef).  Wait times are recorded for both 
+/// exclusive and shared acquisitions, but hold times are only recorded 
+/// for exclusive ones since shared holders overlap.
+class SharedMutex
 {
-	return mBlocks.size();
-}
+public:
+	/**
+	@param name     The name of the lock.
+	@param profiler The profiler that records the lock times.
+	*/
+	explicit SharedMutex(const std::string& name, 
+		Profiler& profiler=Profiler::instance()) :
+		mMutex(),
+		mRef(mMutex, name, profiler),
+		mStats(profiler.getLockStats(name)),
+		mCounters(mStats->getCounters())
+	{
+		// do nothing
+	}
 
-const std::string& Profiler::getBlockName(size_t i) const
-{
-	if (i>=mBlocks.size())
+	void lock()
 	{
-		printError("Invalid block index");
-		static std::string empty="";
-		return empty;
+		mRef.lock();
 	}
-	ProfileBlocks::const_iterator iter=mBlocks.begin();
-	for (size_t j=0;j<i;++j) ++iter;
-	return iter->first;
-}
 
-void Profiler::printError(const std::string& msg) const
-{
-	std::cout << "[QuickProf error] " << msg << std::endl;
-}
+	bool try_lock()
+	{
+		return mRef.try_lock();
+	}
 
-ProfileBlock* Profiler::getProfileBlock(const std::string& name) const
-{
-	ProfileBlocks::const_iterator iter = mBlocks.find(name);
-	if (mBlocks.end() == iter)
+	void unlock()
 	{
-		// The named block does not exist.  Print an error.
-		printError("The profile block named '" + name + 
-			"' does not exist.");
-		return NULL;
+		mRef.unlock();
 	}
-	else return iter->second;
-}
 
-std::string Profiler::getSuffixString(TimeFormat format) const
-{
-	std::string suffix;
-	switch(format)
+	void lock_shared()
 	{
-		case SECONDS: suffix="s"; break;
-		case MILLISECONDS: suffix="ms"; break;
-		case MICROSECONDS: suffix="us"; break;
-		case PERCENT: suffix="%"; break;
-		default: break;
+		if (!mStats->enabled.load(std::memory_order_relaxed))
+		{
+			mMutex.lock_shared();
+		}
+		else if (mMutex.try_lock_shared())
+		{
+			mStats->recordAcquisition(*mCounters, 0, false, true);
+		}
+		else
+		{
+			unsigned long long int waitStart = SteadyClock::getTimeMicroseconds();
+			mMutex.lock_shared();
+			mStats->recordAcquisition(*mCounters, 
+				SteadyClock::getTimeMicroseconds() - waitStart, true, true);
+		}
 	}
-	return suffix;
-}
+
+	bool try_lock_shared()
+	{
+		if (!mMutex.try_lock_shared()) return false;
+		if (mStats->enabled.load(std::memory_order_relaxed))
+		{
+			mStats->recordAcquisition(*mCounters, 0, false, true);
+		}
+		return true;
+	}
+
+	void unlock_shared()
+	{
+		mMutex.unlock_shared();
+	}
+
+private:
+	std::shared_mutex mMutex;
+	MutexRef<std::shared_mutex> mRef;
+	LockStats* mStats;
+	LockCounters* mCounters;
+};
+#endif
+#endif
 
 }
 
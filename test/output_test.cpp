@@ -0,0 +1,169 @@
+/************************************************************************
+* QuickProf                                                             *
+* http://quickprof.sourceforge.net                                      *
+* Copyright (C) 2006-2011                                               *
+* Tyler Streeter (http://www.tylerstreeter.net)                         *
+*                                                                       *
+* This library is free software; you can redistribute it and/or         *
+* modify it under the terms of EITHER:                                  *
+*   (1) The GNU Lesser General Public License as published by the Free  *
+*       Software Foundation; either version 2.1 of the License, or (at  *
+*       your option) any later version. The text of the GNU Lesser      *
+*       General Public License is included with this library in the     *
+*       file license-LGPL.txt.                                          *
+*   (2) The BSD-style license that is included with this library in     *
+*       the file license-BSD.txt.                                       *
+*   (3) The zlib/libpng license that is included with this library in   *
+*       the file license-zlib-libpng.txt.                               *
+*                                                                       *
+* This library is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files    *
+* license-LGPL.txt, license-BSD.txt, and license-zlib-libpng.txt for    *
+* more details.                                                         *
+************************************************************************/
+
+// Checks the data output file compression and rotation.  Returns a 
+// nonzero exit code on failure.
+
+#include "../quickprof.h"
+
+#include <cstdlib>
+
+int numFailures = 0;
+
+void check(bool condition, const std::string& msg)
+{
+	if (condition) return;
+	std::cout << "FAILED: " << msg << std::endl;
+	++numFailures;
+}
+
+std::string makeInput(int kind, size_t size)
+{
+	std::string input;
+	for (size_t i = 0; i < size; ++i)
+	{
+		switch(kind)
+		{
+			// Incompressible bytes.
+			case 0: input.push_back(static_cast<char>(std::rand())); break;
+
+			// A small alphabet with many short matches.
+			case 1: input.push_back(static_cast<char>('a' + std::rand() % 3)); break;
+
+			// Long runs, giving matches longer than 255 bytes.
+			case 2: input.push_back(i % 1000 < 900 ? 'x' : static_cast<char>(std::rand())); break;
+
+			// Text like the data output file.
+			default:
+			{
+				std::ostringstream oss;
+				oss << 0.001 * static_cast<double>(i) << " " << std::rand() % 100 << "\n";
+				input += oss.str();
+				i += oss.str().size() - 1;
+				break;
+			}
+		}
+	}
+	input.resize(size);
+	return input;
+}
+
+void testLzCodec()
+{
+	const size_t sizes[] = {0, 1, 12, 13, 100, 4096, 70000, 300000};
+	for (int kind = 0; kind < 4; ++kind)
+	{
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+		{
+			std::string input = makeInput(kind, sizes[s]);
+
+			// Two frames back to back must decompress to both inputs.
+			std::string compressed;
+			quickprof::LzCodec::compressFrame(input.data(), input.size(), compressed);
+			quickprof::LzCodec::compressFrame(input.data(), input.size(), compressed);
+			std::string output;
+			bool ok = quickprof::LzCodec::decompress(compressed.data(), 
+				compressed.size(), output);
+
+			std::ostringstream msg;
+			msg << "LzCodec round trip (kind " << kind << ", size " << sizes[s] << ")";
+			check(ok && output == input + input, msg.str());
+
+			// Truncated data must be rejected, not crash.
+			if (!compressed.empty())
+			{
+				output.clear();
+				check(!quickprof::LzCodec::decompress(compressed.data(), 
+					compressed.size() - 1, output), msg.str() + " rejects truncation");
+			}
+		}
+	}
+}
+
+void testRotation()
+{
+	const size_t maxFiles = 3;
+	const std::string filename = "output_test.dat";
+
+	quickprof::Profiler profiler;
+	profiler.setOutputRotation(2000, 0, maxFiles);
+	profiler.setOutputCompression(quickprof::BUILTIN_LZ);
+	profiler.init(0, filename);
+	for (int i = 0; i < 1000; ++i)
+	{
+		profiler.beginBlock("block1");
+		profiler.endBlock("block1");
+		profiler.beginBlock("block2");
+		profiler.endBlock("block2");
+		profiler.endCycle();
+	}
+
+	// Re-initializing closes (and flushes) the current file, and rotates 
+	// it out of the way instead of overwriting it.
+	profiler.init(0, filename);
+	profiler.beginBlock("block1");
+	profiler.endBlock("block1");
+	profiler.endCycle();
+	profiler.init();
+
+	// The current file plus maxFiles rotated files must exist, and each 
+	// must decompress on its own and start with a header line.
+	for (size_t i = 0; i <= maxFiles; ++i)
+	{
+		std::ostringstream name;
+		name << filename;
+		if (i > 0) name << "." << i;
+		name << ".qlz";
+
+		std::ostringstream text;
+		bool ok = quickprof::LzCodec::decompressFile(name.str(), text);
+		check(ok, name.str() + " decompresses");
+		check(0 == text.str().compare(0, 7, "# t(s) "), 
+			name.str() + " starts with a header line");
+		std::remove(name.str().c_str());
+	}
+
+	// Older files must have been deleted.
+	std::ostringstream extra;
+	extra << filename << "." << maxFiles + 1 << ".qlz";
+	std::ifstream file(extra.str().c_str());
+	check(!file.is_open(), extra.str() + " was deleted");
+}
+
+int main()
+{
+	std::srand(1);
+
+	testLzCodec();
+	testRotation();
+
+	if (numFailures > 0)
+	{
+		std::cout << numFailures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,395 @@
+/************************************************************************
+* QuickProf                                                             *
+* http://quickprof.sourceforge.net                                      *
+* Copyright (C) 2006-2011                                               *
+* Tyler Streeter (http://www.tylerstreeter.net)                         *
+*                                                                       *
+* This library is free software; you can redistribute it and/or         *
+* modify it under the terms of EITHER:                                  *
+*   (1) The GNU Lesser General Public License as published by the Free  *
+*       Software Foundation; either version 2.1 of the License, or (at  *
+*       your option) any later version. The text of the GNU Lesser      *
+*       General Public License is included with this library in the     *
+*       file license-LGPL.txt.                                          *
+*   (2) The BSD-style license that is included with this library in     *
+*       the file license-BSD.txt.                                       *
+*   (3) The zlib/libpng license that is included with this library in   *
+*       the file license-zlib-libpng.txt.                               *
+*                                                                       *
+* This library is distributed in the hope that it will be useful,       *
+* but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the files    *
+* license-LGPL.txt, license-BSD.txt, and license-zlib-libpng.txt for    *
+* more details.                                                         *
+************************************************************************/
+
+// Checks the profiler features that can be verified without timing 
+// assumptions.  Returns a nonzero exit code on failure.
+
+#include "../quickprof.h"
+
+#ifndef WIN32
+	#include <unistd.h>
+#endif
+
+int numFailures = 0;
+
+void check(bool condition, const std::string& msg)
+{
+	if (condition) return;
+	std::cout << "FAILED: " << msg << std::endl;
+	++numFailures;
+}
+
+void testFoldedStacks()
+{
+	// The same nesting as test.cpp.
+	quickprof::Profiler profiler;
+	profiler.init();
+	for (int i = 0; i < 3; ++i)
+	{
+		profiler.beginBlock("blocks1and2");
+		profiler.beginBlock("block1");
+		profiler.endBlock("block1");
+		profiler.beginBlock("block2");
+		profiler.endBlock("block2");
+		profiler.endBlock("blocks1and2");
+		profiler.beginBlock("block3");
+		profiler.endBlock("block3");
+		profiler.endCycle();
+	}
+
+	std::ostringstream oss;
+	profiler.writeFoldedStacks(oss, quickprof::CALL_COUNT, "main");
+	check(oss.str() == 
+		"main;blocks1and2 3\n"
+		"main;blocks1and2;block1 3\n"
+		"main;blocks1and2;block2 3\n"
+		"main;block3 3\n", "folded stacks of nested blocks:\n" + oss.str());
+
+	// Semicolons separate frames, so they are replaced in block names.
+	profiler.beginBlock("a;b");
+	profiler.endBlock("a;b");
+	oss.str("");
+	profiler.writeFoldedStacks(oss, quickprof::CALL_COUNT);
+	check(std::string::npos != oss.str().find("\na_b 1\n"), 
+		"folded stacks escape semicolons:\n" + oss.str());
+}
+
+void sleepMilliseconds(unsigned int milliseconds)
+{
+#ifdef WIN32
+	::Sleep(milliseconds);
+#else
+	usleep(1000 * milliseconds);
+#endif
+}
+
+void testCpuTiming()
+{
+	if (!quickprof::CpuClock::isSupported()) return;
+
+	quickprof::Profiler profiler;
+	profiler.init();
+	profiler.setCpuTiming(true);
+
+	// A busy loop is almost entirely on-CPU.
+	quickprof::Clock clock;
+	volatile unsigned long long int counter = 0;
+	profiler.beginBlock("busy");
+	while (clock.getTimeMicroseconds() < 40000) ++counter;
+	profiler.endBlock("busy");
+
+	// A sleeping block is almost entirely off-CPU.
+	profiler.beginBlock("sleep");
+	sleepMilliseconds(40);
+	profiler.endBlock("sleep");
+
+	double busy = profiler.getCpuDuration("busy", quickprof::MICROSECONDS) / 
+		profiler.getTotalDuration("busy", quickprof::MICROSECONDS);
+	double sleep = profiler.getCpuDuration("sleep", quickprof::MICROSECONDS) / 
+		profiler.getTotalDuration("sleep", quickprof::MICROSECONDS);
+	std::ostringstream oss;
+	oss << "on-CPU fraction of a busy loop (" << busy << ") and a sleep (" 
+		<< sleep << ")";
+	check(busy > 0.9 && sleep < 0.1, oss.str());
+}
+
+void testArgAggregation()
+{
+	quickprof::Profiler profiler;
+	profiler.init();
+	quickprof::ProfileBlock* block = profiler.getBlockHandle("q");
+	profiler.setArgAggregation(block, 0, 2);
+
+	// Updates without the key argument go to the overflow slot, so they 
+	// don't leak into the next value.
+	profiler.beginBlock(block);
+	profiler.endBlock(block);
+	profiler.beginBlock(block, quickprof::BlockArg());
+	profiler.endBlock(block);
+	long long int keys[] = {5, 7, 9, 5};
+	for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+	{
+		profiler.beginBlock(block, keys[i]);
+		profiler.endBlock(block);
+	}
+
+	const std::vector<quickprof::BlockVariant>& variants = block->variants;
+	check(3 == variants.size(), "aggregation slots");
+	check(quickprof::BlockArg(5LL) == variants[0].key && 2 == variants[0].numCalls, 
+		"first value is aggregated in its own slot");
+	check(quickprof::BlockArg(7LL) == variants[1].key && 1 == variants[1].numCalls, 
+		"second value is aggregated in its own slot");
+	check(3 == variants[2].numCalls, 
+		"missing keys and values beyond the cap go to the overflow slot");
+	check(std::string::npos != profiler.getSummary().find("q:<other>"), 
+		"overflow slot is reported:\n" + profiler.getSummary());
+}
+
+struct EmptyFunction
+{
+	void operator()() const
+	{
+		// do nothing
+	}
+};
+
+void testTrivialBenchmark()
+{
+	quickprof::Profiler profiler;
+	profiler.init();
+	quickprof::Benchmark benchmark(profiler);
+	benchmark.setWarmupTime(0.01);
+	benchmark.setLimits(2, 20, 0.05);
+
+	// An empty function may be optimized away, but the results must 
+	// still be valid numbers.
+	quickprof::BenchmarkResult result = benchmark.run("empty", EmptyFunction());
+	check(result.iterationsPerSample > 0, "trivial benchmark batch size");
+	check(result.medianMicroseconds == result.medianMicroseconds && 
+		result.meanMicroseconds == result.meanMicroseconds && 
+		result.medianMicroseconds >= 0 && result.maxMicroseconds < 1, 
+		"trivial benchmark times: " + result.toString());
+	check(result.numSamples > 0 || !result.converged, 
+		"trivial benchmark without samples does not converge");
+}
+
+void testSnapshots()
+{
+	quickprof::Profiler profiler;
+	profiler.init();
+	quickprof::ProfileBlock* x = profiler.getBlockHandle("x");
+	profiler.addBlockTime(x, 1000);
+	profiler.addBlockTime(x, 1000);
+	profiler.addBlockTime(profiler.getBlockHandle("name with spaces"), 500);
+	profiler.endCycle();
+
+	// Serialized snapshots read back the same.
+	quickprof::ProfileSnapshot earlier = profiler.getSnapshot();
+	std::stringstream ss;
+	earlier.serialize(ss);
+	quickprof::ProfileSnapshot copy;
+	check(quickprof::ProfileSnapshot::deserialize(ss, copy), "snapshot is read back");
+	const quickprof::SnapshotBlock* block = copy.findBlock("name with spaces");
+	check(earlier.getElapsedMicroseconds() == copy.getElapsedMicroseconds() && 
+		2 == copy.getNumBlocks() && block && 500 == block->totalMicroseconds && 
+		1 == block->numCalls, "snapshot round-trip");
+
+	// Subtracting an earlier snapshot leaves the interval's totals.
+	profiler.addBlockTime(x, 3000);
+	quickprof::ProfileSnapshot interval = profiler.getSnapshot() - earlier;
+	block = interval.findBlock("x");
+	check(block && 3000 == block->totalMicroseconds && 1 == block->numCalls && 
+		0 == interval.findBlock("name with spaces")->totalMicroseconds, 
+		"snapshot difference");
+
+	// Merging adds the totals but not the per-cycle averages.
+	quickprof::Profiler merged;
+	merged.init();
+	merged.merge(profiler);
+	merged.merge(copy);
+	check(7000 == merged.getTotalDuration("x", quickprof::MICROSECONDS) && 
+		1000 == merged.getTotalDuration("name with spaces", quickprof::MICROSECONDS), 
+		"merged totals");
+	check(5 == merged.getBlockHandle("x")->numCalls, "merged call counts");
+	check(0 == merged.getAvgDuration("x", quickprof::MICROSECONDS), 
+		"per-cycle averages are not merged");
+
+	// Merging into an uninitialized profiler is an error.
+	quickprof::Profiler uninitialized;
+	uninitialized.merge(profiler);
+	uninitialized.merge(copy);
+	check(0 == uninitialized.getNumBlocks(), 
+		"merging into an uninitialized profiler is ignored");
+}
+
+void setBlockFiltersVariable(const char* rules)
+{
+#ifdef WIN32
+	_putenv((std::string("QUICKPROF_BLOCKS=") + (rules ? rules : "")).c_str());
+#else
+	if (rules) setenv("QUICKPROF_BLOCKS", rules, 1);
+	else unsetenv("QUICKPROF_BLOCKS");
+#endif
+}
+
+void testBlockFilters()
+{
+	// Rules added before init are kept, and the environment rules win.
+	quickprof::Profiler profiler;
+	profiler.disableBlocks("render.*");
+	setBlockFiltersVariable("+render.shadows");
+	profiler.init();
+	check(profiler.getBlockHandle("render.shadows")->enabled, 
+		"environment rules win");
+	check(!profiler.getBlockHandle("render.sky")->enabled, 
+		"rules added before init are kept");
+	check(profiler.getBlockHandle("physics")->enabled, 
+		"blocks matching no rule are enabled");
+
+	// Environment rules are re-read at each init.
+	setBlockFiltersVariable(NULL);
+	profiler.init();
+	check(!profiler.getBlockHandle("render.shadows")->enabled, 
+		"environment rules are dropped when the variable is unset");
+}
+
+void testReinit()
+{
+	quickprof::Profiler profiler;
+	quickprof::ProfileBlock* handle = profiler.getBlockHandle("handle");
+	profiler.init();
+	profiler.beginBlock(handle);
+	profiler.endBlock(handle);
+	profiler.beginBlock("named");
+	profiler.endBlock("named");
+	check(2 == profiler.getNumBlocks(), "blocks before re-init");
+
+	// Re-initializing erases the blocks from the reports, but their 
+	// handles stay valid.
+	profiler.init();
+	check(0 == profiler.getNumBlocks() && profiler.getSummary().empty(), 
+		"blocks are erased by re-init");
+	profiler.beginBlock(handle);
+	profiler.endBlock(handle);
+	check(1 == profiler.getNumBlocks() && "handle" == profiler.getBlockName(0) && 
+		1 == handle->numCalls, "handles are restored after re-init");
+}
+
+#ifdef USE_STD_THREADS
+void testLockStats()
+{
+	quickprof::Profiler profiler;
+	profiler.init();
+
+	// Striped locks share a name, and with it their statistics.
+	std::mutex stripes[2];
+	quickprof::MutexRef<std::mutex> stripe0(stripes[0], "striped", profiler);
+	quickprof::MutexRef<std::mutex> stripe1(stripes[1], "striped", profiler);
+	for (int i = 0; i < 10; ++i)
+	{
+		stripe0.lock();
+		stripe0.unlock();
+		stripe1.lock();
+		stripe1.unlock();
+	}
+	profiler.endCycle();
+
+	quickprof::ProfileBlock* wait = profiler.getBlockHandle("striped.wait");
+	quickprof::ProfileBlock* hold = profiler.getBlockHandle("striped.hold");
+	check(20 == wait->numCalls && 20 == hold->numCalls, "lock calls");
+	check(std::string::npos != profiler.getLockReport().find(
+		"striped: 20 acquisitions, 0% contended"), "lock report acquisitions:\n" + 
+		profiler.getLockReport());
+	check(std::string::npos != profiler.getLockReport().find(
+		"wait histogram (us): <1: 20"), "lock report histogram:\n" + 
+		profiler.getLockReport());
+
+	// Only what changed since the last cycle is added.
+	stripe0.lock();
+	stripe0.unlock();
+	profiler.endCycle();
+	check(21 == wait->numCalls && 21 == hold->numCalls, "lock calls per cycle");
+
+#ifdef USE_STD_SHARED_MUTEX
+	// Shared acquisitions have wait times but no hold times.
+	quickprof::SharedMutex table("table", profiler);
+	table.lock_shared();
+	table.unlock_shared();
+	table.lock();
+	table.unlock();
+	profiler.endCycle();
+	check(2 == profiler.getBlockHandle("table.wait")->numCalls && 
+		1 == profiler.getBlockHandle("table.hold")->numCalls, "shared lock calls");
+#endif
+}
+
+void testRegionHandles()
+{
+	quickprof::Profiler profiler;
+	quickprof::ParallelRegion* pool = profiler.getRegionHandle("pool", 2);
+	profiler.init();
+
+	// Worker 0 is the straggler.
+	profiler.beginParallelRegion("pool");
+	std::thread worker0([&]()
+	{
+		profiler.beginRegionWork(pool, 0);
+		sleepMilliseconds(30);
+		profiler.endRegionWork(pool, 0);
+	});
+	std::thread worker1([&]()
+	{
+		profiler.beginRegionWork(pool, 1);
+		sleepMilliseconds(1);
+		profiler.endRegionWork(pool, 1);
+	});
+	worker0.join();
+	worker1.join();
+	profiler.endParallelRegion("pool");
+	profiler.endCycle();
+
+	std::string report = profiler.getRegionReport();
+	check(0 == report.find("pool: 1 instances") && 
+		std::string::npos != report.find("stragglers: worker 0 (1x)"), 
+		"region report:\n" + report);
+	check(profiler.getAvgImbalance("pool") > 1.5, "region imbalance");
+	check(1 == profiler.getBlockHandle("pool.idle")->numCalls, "region idle calls");
+
+	// The handle stays valid, and the old instances aren't reported.
+	profiler.init();
+	check(profiler.getRegionReport().empty(), "region report after re-init");
+	profiler.beginParallelRegion("pool");
+	profiler.beginRegionWork(pool, 1);
+	sleepMilliseconds(1);
+	profiler.endRegionWork(pool, 1);
+	profiler.endParallelRegion("pool");
+	report = profiler.getRegionReport();
+	check(0 == report.find("pool: 1 instances"), "region handle after re-init:\n" + 
+		report);
+}
+#endif
+
+int main()
+{
+	testFoldedStacks();
+	testCpuTiming();
+	testArgAggregation();
+	testTrivialBenchmark();
+	testSnapshots();
+	testBlockFilters();
+	testReinit();
+#ifdef USE_STD_THREADS
+	testLockStats();
+	testRegionHandles();
+#endif
+
+	if (numFailures > 0)
+	{
+		std::cout << numFailures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}